@@ -0,0 +1,129 @@
+#include <cstring>
+
+#include <nuevdb/IFDatabase/Arena.h>
+
+namespace {
+  const size_t kMinSlabSize = 4096;
+  const size_t kMaxSlabSize = 1 << 22;
+}
+
+//************************************************************
+namespace nutools {
+  namespace dbi {
+
+    Arena::Arena() : fCur(0), fLeft(0), fNextSlabSize(kMinSlabSize),
+                     fNBytes(0), fCapacity(0)
+    {
+    }
+
+    //************************************************************
+
+    Arena::Arena(const Arena&) : fCur(0), fLeft(0),
+                                 fNextSlabSize(kMinSlabSize),
+                                 fNBytes(0), fCapacity(0)
+    {
+    }
+
+    //************************************************************
+
+    Arena& Arena::operator=(const Arena& a)
+    {
+      if (this != &a) Clear();
+      return *this;
+    }
+
+    //************************************************************
+
+    Arena::~Arena()
+    {
+      Clear();
+    }
+
+    //************************************************************
+    void Arena::Clear()
+    {
+      for (unsigned int i=0; i<fSlab.size(); ++i)
+        delete[] fSlab[i];
+      fSlab.clear();
+
+      fCur = 0;
+      fLeft = 0;
+      fNextSlabSize = kMinSlabSize;
+      fNBytes = 0;
+      fCapacity = 0;
+    }
+
+    //************************************************************
+    Arena::Mark Arena::GetMark() const
+    {
+      Mark m;
+      m.nSlab = fSlab.size();
+      m.cur = fCur;
+      m.left = fLeft;
+      m.nextSlabSize = fNextSlabSize;
+      m.nBytes = fNBytes;
+      m.capacity = fCapacity;
+      return m;
+    }
+
+    //************************************************************
+    void Arena::Rewind(const Mark& m)
+    {
+      for (unsigned int i=m.nSlab; i<fSlab.size(); ++i)
+        delete[] fSlab[i];
+      fSlab.resize(m.nSlab);
+
+      fCur = m.cur;
+      fLeft = m.left;
+      fNextSlabSize = m.nextSlabSize;
+      fNBytes = m.nBytes;
+      fCapacity = m.capacity;
+    }
+
+    //************************************************************
+    char* Arena::NewSlab(size_t n)
+    {
+      char* slab = new char[n];
+      fSlab.push_back(slab);
+      fCapacity += n;
+      return slab;
+    }
+
+    //************************************************************
+    char* Arena::Allocate(size_t n)
+    {
+      fNBytes += n;
+
+      if (n <= fLeft) {
+        char* p = fCur;
+        fCur += n;
+        fLeft -= n;
+        return p;
+      }
+
+      // big requests get a slab of their own, so that the rest of the
+      // current slab is not wasted
+      if (n > fNextSlabSize/4)
+        return NewSlab(n);
+
+      fCur = NewSlab(fNextSlabSize);
+      fLeft = fNextSlabSize;
+      if (fNextSlabSize < kMaxSlabSize) fNextSlabSize *= 2;
+
+      char* p = fCur;
+      fCur += n;
+      fLeft -= n;
+      return p;
+    }
+
+    //************************************************************
+    char* Arena::CopyString(const char* v, size_t len)
+    {
+      char* p = Allocate(len+1);
+      memcpy(p,v,len);
+      p[len] = '\0';
+      return p;
+    }
+
+  }
+}
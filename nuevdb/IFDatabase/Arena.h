@@ -0,0 +1,69 @@
+#ifndef __DBIARENA_HPP_
+#define __DBIARENA_HPP_
+
+#include <cstddef>
+#include <vector>
+
+namespace nutools {
+  namespace dbi {
+
+    /**
+     * Bump allocator for the values of a bulk load.
+     *
+     * Memory is handed out from a list of slabs that grow geometrically
+     * in size, and is only ever released all at once, by Clear() or
+     * back to a Mark by Rewind().  A
+     * Table keeps one of these so that loading N values costs a handful
+     * of large allocations instead of N small ones.
+     *
+     * Copying an Arena gives an empty one; Columns copied out of an
+     * arena get their own heap copy of the value, so nothing in the
+     * copy can refer to the original's memory.
+     */
+    class Arena
+    {
+    public:
+      Arena();
+      Arena(const Arena&);
+      ~Arena();
+
+      Arena& operator=(const Arena&);
+
+      char*  Allocate(size_t n);
+      char*  CopyString(const char* v, size_t len); ///< adds a '\0'
+
+      void   Clear();
+
+      /// Where the arena is up to; Rewind() to it releases everything
+      /// allocated since
+      struct Mark {
+        size_t nSlab;
+        char*  cur;
+        size_t left;
+        size_t nextSlabSize;
+        size_t nBytes;
+        size_t capacity;
+      };
+      Mark   GetMark() const;
+      void   Rewind(const Mark& m);
+
+      size_t NSlabs() const { return fSlab.size(); }
+      size_t NBytes() const { return fNBytes; }  ///< bytes handed out
+      size_t Capacity() const { return fCapacity; }
+
+    private:
+      char*  NewSlab(size_t n);
+
+      std::vector<char*> fSlab;
+      char*  fCur;
+      size_t fLeft;
+      size_t fNextSlabSize;
+      size_t fNBytes;
+      size_t fCapacity;
+
+    }; // class end
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
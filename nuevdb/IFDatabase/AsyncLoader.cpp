@@ -0,0 +1,336 @@
+#include <iostream>
+#include <cerrno>
+#include <poll.h>
+
+#include <libpq-fe.h>
+
+#include <nuevdb/IFDatabase/AsyncLoader.h>
+
+//************************************************************
+namespace nutools {
+  namespace dbi {
+
+    AsyncLoader::AsyncLoader() : fAllOk(true)
+    {
+    }
+
+    //************************************************************
+
+    AsyncLoader::~AsyncLoader()
+    {
+      // don't leave tables half loaded, with a query in flight
+      Run();
+    }
+
+    //************************************************************
+    AsyncLoader& AsyncLoader::Default()
+    {
+      static thread_local AsyncLoader loader;
+      return loader;
+    }
+
+    //************************************************************
+    std::future<bool> AsyncLoader::Add(Table& t)
+    {
+      for (unsigned int i=0; i<fLoad.size(); ++i)
+        if (fLoad[i]->table == &t && fLoad[i]->state != kDone) {
+          std::cerr << "AsyncLoader::Add: table \"" << t.Name()
+                    << "\" is already being loaded!" << std::endl;
+          std::promise<bool> p;
+          p.set_value(false);
+          return p.get_future();
+        }
+
+      std::shared_ptr<Load> l = std::make_shared<Load>();
+      l->table = &t;
+      l->state = kQueued;
+      l->hasConn = true;
+      l->isBinary = false;
+      l->isOk = false;
+      l->isPrepared = false;
+      l->result = 0;
+      fLoad.push_back(l);
+
+      if (!Start(*l)) Finish(*l,false);
+
+      return std::async(std::launch::deferred,
+                        [this,l]() { if (l->state != kDone) Run();
+                                     return l->isOk; });
+    }
+
+    //************************************************************
+    bool AsyncLoader::WaitAll()
+    {
+      Run();
+      bool isOk = fAllOk;
+      fAllOk = true;
+      return isOk;
+    }
+
+    //************************************************************
+    bool AsyncLoader::Start(Load& l)
+    {
+      Table& t = *l.table;
+
+      if (t.fIgnoreDB) return false;
+
+      if (t.fSchema == "undef") {
+        std::cerr << "Table::LoadAsync: Detector not set!  Table::SetDetector()"
+                  << " must be called first!" << std::endl;
+        return false;
+      }
+
+      if (!t.fValidityChanged) {
+        l.isOk = true;
+        l.state = kDone;
+        return true;
+      }
+
+      // streaming loads read their cursor batch by batch, so they are
+      // simply run synchronously
+      if (t.fFetchSize > 0 || t.fRowSink) {
+        l.isOk = t.LoadFromDB();
+        l.state = kDone;
+        if (!l.isOk) fAllOk = false;
+        return true;
+      }
+
+      l.hasConn = t.fHasConnection;
+      return Connect(l,false);
+    }
+
+    //************************************************************
+    // Everything LoadFromDB() does up to sending the query.  The table
+    // gets its connection and the query is prepared (if it is to be)
+    // synchronously; both are normally cached, by the pool and the
+    // connection respectively.  If wait is false and the pool is full
+    // the load stays queued.
+    //************************************************************
+    bool AsyncLoader::Connect(Load& l, bool wait)
+    {
+      Table& t = *l.table;
+
+      if (! t.fHasConnection) {
+        t.GetConnection(0,wait);
+        if (t.fPoolBusy) return true;
+      }
+
+      if (!t.fConnection) {
+        std::cerr << "Table::LoadAsync: No connection to the database!" << std::endl;
+        return false;
+      }
+
+      if (!t.ExistsInDB()) {
+        std::cerr << "Table::LoadAsync: Table \"" << t.Name()
+                  << "\" not found in database!" << std::endl;
+        return false;
+      }
+
+      l.sql = t.MakeSelectSQL(&l.params);
+      for (unsigned int i=0; i<l.params.size(); ++i)
+        l.paramValues.push_back(l.params[i].c_str());
+
+      if (t.fPrepareStatements)
+        l.stmtName = t.PrepareStatement(l.sql,l.params.size());
+      l.isPrepared = !l.stmtName.empty();
+
+      // binary results need a description of the columns first, which
+      // needs a prepared statement, if only an unnamed one
+      if (t.fBinaryTransfer)
+        l.state = (l.isPrepared ? kDescribe : kPrepare);
+      else
+        l.state = kExecute;
+
+      return Send(l);
+    }
+
+    //************************************************************
+    bool AsyncLoader::Send(Load& l)
+    {
+      Table& t = *l.table;
+      const char* const* values =
+        (l.paramValues.empty() ? NULL : &l.paramValues[0]);
+      int ok = 0;
+
+      switch (l.state) {
+      case kPrepare:
+        ok = PQsendPrepare(t.fConnection,"",l.sql.c_str(),l.params.size(),
+                           NULL);
+        break;
+      case kDescribe:
+        ok = PQsendDescribePrepared(t.fConnection,l.stmtName.c_str());
+        break;
+      case kExecute:
+        if (t.fVerbosity > 0)
+          std::cerr << "Table::LoadAsync: Executing PGSQL command: \n\t"
+                    << l.sql << std::endl;
+        l.t0 = std::chrono::steady_clock::now();
+        if (l.isPrepared)
+          ok = PQsendQueryPrepared(t.fConnection,l.stmtName.c_str(),
+                                   l.params.size(),values,NULL,NULL,
+                                   (l.isBinary ? 1 : 0));
+        else
+          ok = PQsendQueryParams(t.fConnection,l.sql.c_str(),
+                                 l.params.size(),NULL,values,NULL,NULL,
+                                 (l.isBinary ? 1 : 0));
+        break;
+      default:
+        return false;
+      }
+
+      if (!ok)
+        std::cerr << "Table::LoadAsync(" << t.Name() << "): sending query "
+                  << "failed: " << PQerrorMessage(t.fConnection) << std::endl;
+      return (ok != 0);
+    }
+
+    //************************************************************
+    // Called once all the results of the current step are in; moves on
+    // to the next one.
+    //************************************************************
+    bool AsyncLoader::Advance(Load& l)
+    {
+      Table& t = *l.table;
+      ExecStatusType status = PQresultStatus(l.result);
+
+      switch (l.state) {
+      case kPrepare:
+        if (status != PGRES_COMMAND_OK) {
+          std::cerr << "PREPARE failed: " << PQerrorMessage(t.fConnection)
+                    << std::endl;
+          return false;
+        }
+        l.isPrepared = true;
+        l.state = kDescribe;
+        break;
+      case kDescribe:
+        l.isBinary = t.CanLoadBinary(l.result);
+        if (!l.isBinary && t.fVerbosity > 0)
+          std::cerr << "Table::LoadAsync(" << t.Name() << "): cannot decode "
+                    << "binary results, using text." << std::endl;
+        l.state = kExecute;
+        break;
+      case kExecute:
+        if (t.fTimeQueries) {
+          std::chrono::milliseconds tdiff =
+            std::chrono::duration_cast<std::chrono::milliseconds>
+            (std::chrono::steady_clock::now() - l.t0);
+          std::cerr << "Table::LoadAsync(" << t.Name() << "): query took "
+                    << tdiff.count() << " ms" << std::endl;
+        }
+        if (status != PGRES_TUPLES_OK) {
+          std::cerr << "SELECT failed: " << PQerrorMessage(t.fConnection)
+                    << std::endl;
+          return false;
+        }
+        t.CacheRows(l.result,l.isBinary);
+        Finish(l,true);
+        return true;
+      default:
+        return false;
+      }
+
+      PQclear(l.result);
+      l.result = 0;
+      return Send(l);
+    }
+
+    //************************************************************
+    void AsyncLoader::Finish(Load& l, bool isOk)
+    {
+      Table& t = *l.table;
+
+      if (l.result) PQclear(l.result);
+      l.result = 0;
+
+      if (!isOk)
+        t.CloseConnection();
+      else {
+        if (!l.hasConn) t.CloseConnection();
+        t.fValidityChanged = false;
+      }
+
+      l.isOk = isOk;
+      l.state = kDone;
+      if (!isOk) fAllOk = false;
+    }
+
+    //************************************************************
+    // Wait for results on all connections at once, and move each load
+    // along as its results come in.
+    //************************************************************
+    void AsyncLoader::Run()
+    {
+      std::vector<struct pollfd> fds;
+      std::vector<Load*> active;
+
+      while (true) {
+        // start whatever we can get connections for; if nothing is
+        // running, the first queued load waits for one
+        Load* queued = 0;
+        bool running = false;
+        for (unsigned int i=0; i<fLoad.size(); ++i) {
+          Load& l = *fLoad[i];
+          if (l.state == kQueued && !Connect(l,false)) Finish(l,false);
+          if (l.state == kQueued && !queued) queued = &l;
+          if (l.state != kQueued && l.state != kDone) running = true;
+        }
+        if (queued && !running && !Connect(*queued,true))
+          Finish(*queued,false);
+
+        fds.clear();
+        active.clear();
+        for (unsigned int i=0; i<fLoad.size(); ++i) {
+          if (fLoad[i]->state == kDone || fLoad[i]->state == kQueued)
+            continue;
+          struct pollfd p;
+          p.fd = PQsocket(fLoad[i]->table->fConnection);
+          p.events = POLLIN;
+          p.revents = 0;
+          fds.push_back(p);
+          active.push_back(fLoad[i].get());
+        }
+        if (active.empty()) {
+          if (queued) continue;
+          break;
+        }
+
+        if (poll(&fds[0],fds.size(),-1) < 0) {
+          if (errno == EINTR) continue;
+          std::cerr << "AsyncLoader::Run: poll() failed, errno = " << errno
+                    << std::endl;
+          for (unsigned int i=0; i<active.size(); ++i)
+            Finish(*active[i],false);
+          break;
+        }
+
+        for (unsigned int i=0; i<active.size(); ++i) {
+          if (!fds[i].revents) continue;
+          Load& l = *active[i];
+          PGconn* conn = l.table->fConnection;
+
+          if (!PQconsumeInput(conn)) {
+            std::cerr << "Table::LoadAsync(" << l.table->Name() << "): "
+                      << PQerrorMessage(conn) << std::endl;
+            Finish(l,false);
+            continue;
+          }
+
+          while (l.state != kDone && !PQisBusy(conn)) {
+            PGresult* res = PQgetResult(conn);
+            if (res) {
+              // keep the last result of the step, eg. the error
+              if (l.result) PQclear(l.result);
+              l.result = res;
+            }
+            else if (!Advance(l))
+              Finish(l,false);
+          }
+        }
+      }
+
+      fLoad.clear();
+    }
+
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef __DBIASYNCLOADER_HPP_
+#define __DBIASYNCLOADER_HPP_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <chrono>
+
+#include "nuevdb/IFDatabase/Table.h"
+
+namespace nutools {
+  namespace dbi {
+
+    /**
+     * Runs the LoadFromDB() queries of many Tables at once.
+     *
+     * Each table gets its own connection (from its ConnectionPool, if it
+     * has one), and the queries are sent with the non-blocking libpq
+     * calls and driven from a single thread with poll(), so the time to
+     * load N tables is that of the slowest query rather than the sum.
+     * Tables that cannot get a connection because their pool is full
+     * wait their turn until one of the others is done.
+     *
+     * Nothing happens until the loader is driven, either by WaitAll() or
+     * by get() on one of the futures returned by Add().  A loader and its
+     * tables must only be used from one thread, and must outlive the
+     * futures.
+     */
+    class AsyncLoader
+    {
+    public:
+      AsyncLoader();
+      ~AsyncLoader();
+
+      AsyncLoader(const AsyncLoader&) = delete;
+      AsyncLoader& operator=(const AsyncLoader&) = delete;
+
+      std::future<bool> Add(Table& t);
+
+      /// Run all pending loads to completion; false if any failed.
+      bool WaitAll();
+
+      unsigned int NPending() const { return fLoad.size(); }
+
+      /// The loader used by Table::LoadAsync() on this thread
+      static AsyncLoader& Default();
+
+    private:
+      enum State {
+        kQueued,    ///< waiting for a connection from a full pool
+        kPrepare,
+        kDescribe,
+        kExecute,
+        kDone
+      };
+
+      struct Load {
+        Table*      table;
+        int         state;
+        bool        hasConn;
+        bool        isBinary;
+        bool        isOk;
+        bool        isPrepared;
+        std::string sql;
+        std::string stmtName;
+        std::vector<std::string> params;
+        std::vector<const char*> paramValues;
+        PGresult*   result;
+        std::chrono::steady_clock::time_point t0; ///< for fTimeQueries
+      };
+
+      void Run();
+      bool Start(Load& l);
+      bool Connect(Load& l, bool wait);
+      bool Send(Load& l);
+      bool Advance(Load& l);
+      void Finish(Load& l, bool isOk);
+
+      std::vector<std::shared_ptr<Load> > fLoad;
+      bool fAllOk;
+
+    }; // class end
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
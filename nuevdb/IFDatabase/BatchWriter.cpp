@@ -0,0 +1,371 @@
+#include <iostream>
+#include <sstream>
+#include <map>
+#include <cerrno>
+#include <poll.h>
+
+#include <libpq-fe.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <nuevdb/IFDatabase/BatchWriter.h>
+#include <nuevdb/IFDatabase/Util.h>
+
+namespace {
+  // RunPipeline() returns the index of the statement that failed, or
+  // one of these
+  const int kAllOk = -1;
+  const int kBroken = -2;  ///< nothing can be said about any statement
+}
+
+//************************************************************
+namespace nutools {
+  namespace dbi {
+
+    BatchWriter::BatchWriter()
+    {
+    }
+
+    //************************************************************
+    void BatchWriter::Add(Table& t)
+    {
+      for (unsigned int i=0; i<fTable.size(); ++i)
+        if (fTable[i] == &t) return;
+      fTable.push_back(&t);
+    }
+
+    //************************************************************
+    bool BatchWriter::Write(bool commit)
+    {
+      bool retVal = true;
+
+#ifndef LIBPQ_HAS_PIPELINING
+      for (unsigned int i=0; i<fTable.size(); ++i)
+        if (! fTable[i]->WriteToDB(commit)) retVal = false;
+      fTable.clear();
+      return retVal;
+#else
+      // tables that share a database share a pipeline
+      std::vector<std::string> keys;
+      std::map<std::string,std::vector<Table*> > group;
+      for (unsigned int i=0; i<fTable.size(); ++i) {
+        Table& t = *fTable[i];
+        if (! t.CheckForNulls()) {
+          retVal = false;
+          continue;
+        }
+        t.FillRowViews();
+
+        try {
+          t.GetConnectionInfo();
+        }
+        catch (std::runtime_error& e) {
+          std::cerr << e.what() << std::endl;
+          retVal = false;
+          continue;
+        }
+
+        std::string key = t.fDBHost + ":" + t.fDBPort + "/" + t.fDBName +
+          " " + t.fUser + " " + t.fRole;
+        if (group.find(key) == group.end()) keys.push_back(key);
+        group[key].push_back(&t);
+      }
+      fTable.clear();
+
+      std::string ts = Util::GetCurrentTimeAsString();
+
+      for (unsigned int i=0; i<keys.size(); ++i)
+        if (! WriteGroup(group[keys[i]],ts,commit)) retVal = false;
+
+      return retVal;
+#endif
+    }
+
+    //************************************************************
+    // The statements WriteToDB() would execute for table t.
+    //************************************************************
+    void BatchWriter::MakeStatements(Table& t, const std::string& ts,
+                                     std::vector<Stmt>& stmt)
+    {
+      std::map<std::string,int> colMap = t.GetColNameToIndexMap();
+      int insertTimeIdx = colMap["inserttime"];
+      int insertUserIdx = colMap["insertuser"];
+      int updateTimeIdx = colMap["updatetime"];
+      int updateUserIdx = colMap["updateuser"];
+
+      std::ostringstream ret;
+      for (unsigned int j=0; j<t.fCol.size(); ++j)
+        if (t.fCol[j].Type() == "autoincr")
+          ret << (ret.tellp() == 0 ? " RETURNING " : ",") << t.fCol[j].Name();
+
+      for (unsigned int i=0; i<t.fRow.size(); ++i) {
+        Stmt s;
+        s.table = &t;
+        s.row = i;
+        s.state = kPending;
+
+        if (! t.fRow[i].InDB()) {
+          Row r(t.fRow[i]);
+          if (t.addInsertTime) r.Set(insertTimeIdx,ts);
+          if (t.addInsertUser) r.Set(insertUserIdx,t.fUser);
+          s.isInsert = true;
+          s.timeIdx = insertTimeIdx;
+          s.userIdx = insertUserIdx;
+          s.sql = t.MakeInsertSQL(r);
+          s.returning = ret.str();
+        }
+        else if (t.fRow[i].NModified() > 0) {
+          Row r(t.fRow[i]);
+          if (t.addUpdateTime) r.Update(updateTimeIdx,ts);
+          if (t.addUpdateUser) r.Update(updateUserIdx,t.fUser);
+          s.isInsert = false;
+          s.timeIdx = updateTimeIdx;
+          s.userIdx = updateUserIdx;
+          s.sql = t.MakeUpdateSQL(r);
+        }
+        else
+          continue;
+
+        if (t.fVerbosity > 0)
+          std::cerr << "BatchWriter::Write: Queueing PGSQL command: \n\t"
+                    << s.sql << std::endl;
+        stmt.push_back(s);
+      }
+    }
+
+    //************************************************************
+    bool BatchWriter::WriteGroup(const std::vector<Table*>& tables,
+                                 const std::string& ts, bool commit)
+    {
+      std::vector<Stmt> stmt;
+      for (unsigned int i=0; i<tables.size(); ++i)
+        MakeStatements(*tables[i],ts,stmt);
+      if (stmt.empty()) return true;
+
+      if (!commit) {
+        for (unsigned int i=0; i<stmt.size(); ++i)
+          std::cout << stmt[i].sql << std::endl;
+        return true;
+      }
+
+      // all statements go down the first table's connection
+      Table& t0 = *tables[0];
+      bool doWrite = ! t0.fIgnoreDB;
+      bool hasConn = t0.fHasConnection;
+
+      if (doWrite) {
+        if (! t0.fHasConnection) {
+          t0.GetConnection();
+          hasConn = false;
+        }
+        if (!t0.fConnection) {
+          std::cerr << "BatchWriter::Write: No connection to the database!"
+                    << std::endl;
+          doWrite = false;
+        }
+      }
+
+      bool retVal = true;
+      unsigned int npending = stmt.size();
+
+      // each failure takes its statement out and the rest are sent again
+      while (doWrite && npending > 0) {
+        int ifail = RunPipeline(t0,stmt);
+        if (ifail == kAllOk) break;
+        retVal = false;
+        if (ifail == kBroken) break;
+        Fail(stmt[ifail]);
+        --npending;
+      }
+
+      for (unsigned int i=0; i<stmt.size(); ++i) {
+        if (stmt[i].state == kOk)
+          Apply(stmt[i],ts);
+        else if (stmt[i].state == kPending) {
+          stmt[i].table->CacheDBCommand(stmt[i].sql);
+          retVal = false;
+        }
+      }
+
+      if (! hasConn) t0.CloseConnection();
+
+      return retVal;
+    }
+
+    //************************************************************
+    // Send BEGIN, all pending statements and COMMIT in one pipeline, and
+    // read back the results.  If all went well the statements are marked
+    // kOk; otherwise the transaction is rolled back and nothing is marked.
+    //************************************************************
+    int BatchWriter::RunPipeline(Table& t0, std::vector<Stmt>& stmt)
+    {
+#ifndef LIBPQ_HAS_PIPELINING
+      (void)t0;
+      (void)stmt;
+      return kBroken;
+#else
+      PGconn* conn = t0.fConnection;
+
+      boost::posix_time::ptime ctt1;
+      boost::posix_time::ptime ctt2;
+
+      if (t0.fTimeQueries)
+        ctt1 = boost::posix_time::microsec_clock::local_time();
+
+      if (! PQenterPipelineMode(conn)) {
+        std::cerr << "BatchWriter::Write: cannot enter pipeline mode: "
+                  << PQerrorMessage(conn) << std::endl;
+        return kBroken;
+      }
+      PQsetnonblocking(conn,1);
+
+      // index into stmt of each command sent, or -1 for our own
+      std::vector<int> sent;
+      bool isOk = true;
+      std::string schema;
+
+      isOk = PQsendQueryParams(conn,"BEGIN",0,NULL,NULL,NULL,NULL,0);
+      sent.push_back(-1);
+      for (unsigned int i=0; i<stmt.size() && isOk; ++i) {
+        Stmt& s = stmt[i];
+        if (s.state != kPending) continue;
+        s.keys.clear();
+
+        // LOCAL, so that the setting does not outlive the transaction
+        if (s.table->fSchema != schema) {
+          schema = s.table->fSchema;
+          std::string cmd = "SET LOCAL search_path TO " + schema;
+          isOk = PQsendQueryParams(conn,cmd.c_str(),0,NULL,NULL,NULL,NULL,0);
+          sent.push_back(-1);
+          if (!isOk) break;
+        }
+
+        std::string cmd = s.sql + s.returning;
+        isOk = PQsendQueryParams(conn,cmd.c_str(),0,NULL,NULL,NULL,NULL,0);
+        sent.push_back(i);
+      }
+      if (isOk)
+        isOk = PQsendQueryParams(conn,"COMMIT",0,NULL,NULL,NULL,NULL,0);
+      sent.push_back(-1);
+      if (isOk)
+        isOk = PQpipelineSync(conn);
+
+      // everything is buffered until now; push it out, reading whatever
+      // the server sends back meanwhile so that neither side blocks
+      while (isOk) {
+        int f = PQflush(conn);
+        if (f == 0) break;
+        if (f < 0) {
+          isOk = false;
+          break;
+        }
+        struct pollfd p;
+        p.fd = PQsocket(conn);
+        p.events = POLLIN | POLLOUT;
+        p.revents = 0;
+        if (poll(&p,1,-1) < 0 && errno != EINTR) isOk = false;
+        else if ((p.revents & POLLIN) && !PQconsumeInput(conn)) isOk = false;
+      }
+      PQsetnonblocking(conn,0);
+
+      if (!isOk) {
+        std::cerr << "BatchWriter::Write: sending pipeline failed: "
+                  << PQerrorMessage(conn) << std::endl;
+        t0.CloseConnection();
+        return kBroken;
+      }
+
+      // one result per command, each followed by a NULL, then the sync
+      int ifail = kAllOk;
+      PGresult* res;
+      for (unsigned int k=0; k<sent.size(); ++k) {
+        res = PQgetResult(conn);
+        if (!res) {
+          std::cerr << "BatchWriter::Write: lost pipeline results: "
+                    << PQerrorMessage(conn) << std::endl;
+          t0.CloseConnection();
+          return kBroken;
+        }
+
+        ExecStatusType status = PQresultStatus(res);
+        if (status == PGRES_FATAL_ERROR && ifail == kAllOk) {
+          ifail = (sent[k] < 0 ? kBroken : sent[k]);
+          if (ifail == kBroken)
+            std::cerr << "BatchWriter::Write: transaction failed: ";
+          else
+            std::cerr << (stmt[ifail].isInsert ? "INSERT" : "UPDATE")
+                      << " failed: ";
+          std::cerr << PQresultErrorMessage(res) << std::endl;
+        }
+        else if (status == PGRES_TUPLES_OK && sent[k] >= 0 &&
+                 PQntuples(res) == 1) {
+          for (int j=0; j<PQnfields(res); ++j)
+            stmt[sent[k]].keys.push_back(PQgetvalue(res,0,j));
+        }
+        PQclear(res);
+
+        while ((res = PQgetResult(conn)) != NULL)
+          PQclear(res);
+      }
+
+      while ((res = PQgetResult(conn)) != NULL) {
+        bool isSync = (PQresultStatus(res) == PGRES_PIPELINE_SYNC);
+        PQclear(res);
+        if (isSync) break;
+      }
+      PQexitPipelineMode(conn);
+
+      if (t0.fTimeQueries) {
+        ctt2 = boost::posix_time::microsec_clock::local_time();
+        boost::posix_time::time_duration tdiff = ctt2 - ctt1;
+        std::cerr << "BatchWriter::Write: pipeline of " << sent.size()
+                  << " commands took " << tdiff.total_milliseconds()
+                  << " ms" << std::endl;
+      }
+
+      if (ifail != kAllOk) {
+        res = PQexec(conn,"ROLLBACK");
+        PQclear(res);
+        return ifail;
+      }
+
+      for (unsigned int i=0; i<stmt.size(); ++i)
+        if (stmt[i].state == kPending) stmt[i].state = kOk;
+
+      return kAllOk;
+#endif
+    }
+
+    //************************************************************
+    // Update the row of a statement that made it into the dB, as
+    // WriteToDB() does.
+    //************************************************************
+    void BatchWriter::Apply(Stmt& s, const std::string& ts)
+    {
+      Table& t = *s.table;
+      Row& r = t.fRow[s.row];
+
+      if (s.isInsert) {
+        r.SetInDB();
+        if (t.addInsertTime) r.Col(s.timeIdx).Set(ts);
+        if (t.addInsertUser) r.Col(s.userIdx).Set(t.fUser);
+        unsigned int k = 0;
+        for (unsigned int j=0; j<t.fCol.size() && k<s.keys.size(); ++j)
+          if (t.fCol[j].Type() == "autoincr")
+            r.Col(j).Set(s.keys[k++],true);
+      }
+      else {
+        if (t.addUpdateTime) r.Col(s.timeIdx).Set(ts);
+        if (t.addUpdateUser) r.Col(s.userIdx).Set(t.fUser);
+      }
+    }
+
+    //************************************************************
+    void BatchWriter::Fail(Stmt& s)
+    {
+      s.state = kFailed;
+      s.table->CacheDBCommand(s.sql);
+    }
+
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef __DBIBATCHWRITER_HPP_
+#define __DBIBATCHWRITER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "nuevdb/IFDatabase/Table.h"
+
+namespace nutools {
+  namespace dbi {
+
+    /**
+     * Writes the new and modified rows of many Tables at once, as
+     * WriteToDB() does for one.
+     *
+     * All of the INSERT and UPDATE statements of the tables that live in
+     * the same database are sent down one connection with libpq's
+     * pipeline mode (PostgreSQL 14 and later), inside one transaction,
+     * so that writing them takes about one round trip to the server
+     * rather than one per statement.  Tables in other databases get a
+     * pipeline of their own.
+     *
+     * A statement that fails aborts the transaction; its row is written
+     * to the table's DB cache file with CacheDBCommand() and the rest
+     * are sent again without it, so every row either ends up in the
+     * database or in the cache file, never both.  autoincr values of new
+     * rows are read back with RETURNING.
+     *
+     * With a libpq that has no pipeline mode each table is simply
+     * written with WriteToDB().
+     */
+    class BatchWriter
+    {
+    public:
+      BatchWriter();
+
+      BatchWriter(const BatchWriter&) = delete;
+      BatchWriter& operator=(const BatchWriter&) = delete;
+
+      void Add(Table& t);
+      void Clear() { fTable.clear(); }
+      unsigned int NTable() const { return fTable.size(); }
+
+      /// Write all tables and forget them; false if any row failed.
+      /// If commit is false the SQL is printed instead.
+      bool Write(bool commit=true);
+
+    private:
+      enum State {
+        kPending,
+        kOk,
+        kFailed
+      };
+
+      struct Stmt {
+        Table*       table;
+        unsigned int row;
+        bool         isInsert;
+        int          state;
+        int          timeIdx;    ///< insert- or updatetime column
+        int          userIdx;    ///< insert- or updateuser column
+        std::string  sql;        ///< as written to the cache file
+        std::string  returning;  ///< RETURNING clause for autoincr columns
+        std::vector<std::string> keys;  ///< autoincr values read back
+      };
+
+      bool WriteGroup(const std::vector<Table*>& tables,
+                      const std::string& ts, bool commit);
+      void MakeStatements(Table& t, const std::string& ts,
+                          std::vector<Stmt>& stmt);
+      int  RunPipeline(Table& t0, std::vector<Stmt>& stmt);
+      void Apply(Stmt& s, const std::string& ts);
+      void Fail(Stmt& s);
+
+      std::vector<Table*> fTable;
+
+    }; // class end
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
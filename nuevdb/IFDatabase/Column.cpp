@@ -10,6 +10,30 @@
 #include <nuevdb/IFDatabase/ColumnDef.h>
 #include <nuevdb/IFDatabase/Util.h>
 
+namespace {
+  //************************************************************
+  // The fraction of a second in a timestamp ("... hh:mm:ss.ffffff"),
+  // in microseconds; 0 if there is none
+  //************************************************************
+  int64_t FractionUSec(const std::string& ts)
+  {
+    size_t i = ts.find(':');
+    if (i == std::string::npos) return 0;
+    i = ts.find(':',i+1);
+    if (i == std::string::npos) return 0;
+    i += 1;
+    while (i < ts.size() && isdigit(ts[i])) ++i;
+    if (i >= ts.size() || ts[i] != '.') return 0;
+
+    int64_t usec = 0;
+    int n = 0;
+    for (++i; i < ts.size() && isdigit(ts[i]) && n < 6; ++i, ++n)
+      usec = usec*10 + (ts[i]-'0');
+    for (; n < 6; ++n) usec *= 10;
+    return usec;
+  }
+}
+
 //************************************************************
 namespace nutools {
   namespace dbi {
@@ -18,6 +42,11 @@ namespace nutools {
 	fModified(false)
     {
       fValue = 0;
+      fOwned = true;
+      fStore = 0;
+      fKeyState = kKeyUnknown;
+      fStoreRow = 0;
+      fStoreCol = 0;
       fType = kIntLike;
 
       std::string t = c.Type();
@@ -34,268 +63,220 @@ namespace nutools {
     
     Column::Column(const Column& c)
     {
-      if (!c.fValue)
-	fValue=0;
-      else {
+      fValue = 0;
+      fOwned = true;
+      CopyValue(c);
+      fType = c.fType;
+      fModified = c.fModified;
+      fKeyState = c.fKeyState;
+      fKey = c.fKey;
+
+    }
+
+    //************************************************************
+    // A copy gets its own heap copy of the value, even if c keeps it in
+    // an Arena or is a view of a ColumnStore: the copy may well outlive
+    // either of them.
+    //************************************************************
+    void Column::CopyValue(const Column& c)
+    {
+      FreeValue();
+      fStore = 0;
+      fStoreRow = 0;
+      fStoreCol = 0;
+      if (c.fValue) {
 	fValue = new char[strlen(c.fValue)+1];
 	strcpy(fValue,c.fValue);
       }
+      else if (c.fStore && !c.fStore->IsNull(c.fStoreRow,c.fStoreCol)) {
+	std::string v = c.fStore->GetString(c.fStoreRow,c.fStoreCol);
+	fValue = new char[v.length()+1];
+	strcpy(fValue,v.c_str());
+      }
+    }
+
+    //************************************************************
+    
+    Column::Column(Column&& c) noexcept
+    {
+      fValue = c.fValue;
+      fOwned = c.fOwned;
       fType = c.fType;
       fModified = c.fModified;
-
+      fStore = c.fStore;
+      fStoreRow = c.fStoreRow;
+      fStoreCol = c.fStoreCol;
+      fKeyState = c.fKeyState;
+      fKey = c.fKey;
+      c.fValue = 0;
+      c.fOwned = true;
     }
 
     //************************************************************
     
     Column::~Column()
     {
-      if (fValue) delete[] fValue;
+      FreeValue();
     }
     
+    //************************************************************
+    
+    Column& Column::operator=(const Column& c)
+    {
+      if (this == &c) return *this;
+
+      CopyValue(c);
+      fType = c.fType;
+      fModified = c.fModified;
+      fKeyState = c.fKeyState;
+      fKey = c.fKey;
+
+      return *this;
+    }
+
+    //************************************************************
+    
+    Column& Column::operator=(Column&& c) noexcept
+    {
+      if (this == &c) return *this;
+
+      FreeValue();
+      fValue = c.fValue;
+      fOwned = c.fOwned;
+      fType = c.fType;
+      fModified = c.fModified;
+      fStore = c.fStore;
+      fStoreRow = c.fStoreRow;
+      fStoreCol = c.fStoreCol;
+      fKeyState = c.fKeyState;
+      fKey = c.fKey;
+      c.fValue = 0;
+      c.fOwned = true;
+
+      return *this;
+    }
+
     //************************************************************
     void Column::Clear() 
     {
-      if (fValue) {
-	delete fValue;
-	fValue = 0;
-      }
+      FreeValue();
+      fStore = 0;
       //      fIsNull = true;
       fModified = false; 
     }
     
     //************************************************************
-    bool Column::operator >= (const Column& c) const
+    void Column::FillKey() const
     {
-      if (c.Type() != fType) return false;
-      
-      std::string val1 = fValue;
-      std::string val2 = c.fValue;
-      
-      if (fType == kBool) {
-	bool a = (val1 == "1");
-	bool b = (val2 == "1");
-	return ((a == b) || (a&!b));
+      fKeyState = kKeyInvalid;
+      if (IsNull()) return;
+
+      switch (fType) {
+      case kBool: {
+	bool b;
+	if (QuietGet(b)) { fKey.i = b; fKeyState = kKeyInt; }
+	break;
       }
-      
-      if (fType == kIntLike) {
-	long a = boost::lexical_cast<long>(val1);
-	long b = boost::lexical_cast<long>(val2);
-	return (a >= b);
+      case kIntLike:
+      case kAutoIncr: {
+	int64_t i;
+	if (QuietGet(i)) { fKey.i = i; fKeyState = kKeyInt; }
+	break;
       }
-      
-      if (fType == kFloatLike) {
-	double a = boost::lexical_cast<double>(val1);
-	double b = boost::lexical_cast<double>(val2);
-	return (a >= b);
+      case kFloatLike: {
+	double d;
+	if (QuietGet(d) && d == d) { fKey.d = d; fKeyState = kKeyDouble; }
+	break;
       }
-      
-      if (fType == kString) 
-	return (val1 >= val2);
-      
-      if (fType == kTimeStamp) {
-	std::string a, b;
-	if (this->Get(a) && c.Get(b)) {
-	  time_t tta, ttb;
-	  if (nutools::dbi::Util::TimeAsStringToTime_t(a,tta) && 
-	      nutools::dbi::Util::TimeAsStringToTime_t(b,ttb) ) 
-	    return (tta >= ttb);
+      case kTimeStamp: {
+	// microseconds, so that fractions of a second still count
+	std::string v = Value();
+	time_t t;
+	if (nutools::dbi::Util::TimeAsStringToTime_t(v,t)) {
+	  fKey.i = int64_t(t)*1000000 + FractionUSec(v);
+	  fKeyState = kKeyInt;
 	}
-	else 
-	  return false;
+	break;
       }
-      
-      if (fType == kDateStamp) {
-	std::string a, b;
-	if (this->Get(a) && c.Get(b)) {
-	  time_t tta, ttb;
-	  if (nutools::dbi::Util::DateAsStringToTime_t(a,tta) && 
-	      nutools::dbi::Util::DateAsStringToTime_t(b,ttb) ) 
-	    return (tta >= ttb);
+      case kDateStamp: {
+	time_t t;
+	if (nutools::dbi::Util::DateAsStringToTime_t(Value(),t)) {
+	  fKey.i = t; fKeyState = kKeyInt;
 	}
-	else 
-	  return false;
+	break;
       }
-      return false;
-      
+      default:
+	break;
+      }
+    }
+
+    //************************************************************
+    bool Column::Compare(const Column& c, int& cmp) const
+    {
+      if (c.fType != fType) return false;
+
+      if (fType == kString) {
+	if (IsNull() || c.IsNull()) return false;
+	if (fValue && c.fValue)
+	  cmp = strcmp(fValue,c.fValue);
+	else
+	  cmp = Value().compare(c.Value());
+	return true;
+      }
+
+      if (fKeyState == kKeyUnknown) FillKey();
+      if (c.fKeyState == kKeyUnknown) c.FillKey();
+      if (fKeyState == kKeyInvalid || fKeyState != c.fKeyState) return false;
+
+      if (fKeyState == kKeyInt)
+	cmp = (fKey.i > c.fKey.i) - (fKey.i < c.fKey.i);
+      else
+	cmp = (fKey.d > c.fKey.d) - (fKey.d < c.fKey.d);
+      return true;
+    }
+
+    //************************************************************
+    bool Column::operator >= (const Column& c) const
+    {
+      int cmp;
+      return (Compare(c,cmp) && cmp >= 0);
     }
     
     //************************************************************
     bool Column::operator > (const Column& c) const
     {
-      if (c.Type() != fType) return false;
-      
-      std::string val1 = fValue;
-      std::string val2 = c.fValue;
-      
-      if (fType == kBool) {
-	bool a = (val1 == "1");
-	bool b = (val2 == "1");
-	return (a&!b);
-      }
-      
-      if (fType == kIntLike) {
-	long a = boost::lexical_cast<long>(val1);
-	long b = boost::lexical_cast<long>(val2);
-	return (a > b);
-      }
-      
-      if (fType == kFloatLike) {
-	double a = boost::lexical_cast<double>(val1);
-	double b = boost::lexical_cast<double>(val2);
-	return (a > b);
-      }
-      
-      if (fType == kString) 
-	return (val1 > val2);
-      
-      if (fType == kTimeStamp) {
-	std::string a, b;
-	if (this->Get(a) && c.Get(b)) {
-	  time_t tta, ttb;
-	  if (nutools::dbi::Util::TimeAsStringToTime_t(a,tta) && 
-	      nutools::dbi::Util::TimeAsStringToTime_t(b,ttb) ) 
-	    return (tta > ttb);
-	}
-	else 
-	  return false;
-      }
-      
-      if (fType == kDateStamp) {
-	std::string a, b;
-	if (this->Get(a) && c.Get(b)) {
-	  time_t tta, ttb;
-	  if (nutools::dbi::Util::DateAsStringToTime_t(a,tta) && 
-	      nutools::dbi::Util::DateAsStringToTime_t(b,ttb) ) 
-	    return (tta > ttb);
-	}
-	else 
-	  return false;
-      }
-      return false;
-      
+      int cmp;
+      return (Compare(c,cmp) && cmp > 0);
     }
     
     //************************************************************
     bool Column::operator <= (const Column& c) const
     {
-      if (c.fType != fType) return false;
-      
-      std::string val1 = fValue;
-      std::string val2 = c.fValue;
-      
-      if (fType == kBool) {
-	bool a = (val1 == "1");
-	bool b = (val2 == "1");
-	return ((a == b) || (!a&b));
-      }
-      
-      if (fType == kIntLike) {
-	long a = boost::lexical_cast<long>(val1);
-	long b = boost::lexical_cast<long>(val2);
-	return (a <= b);
-      }
-      
-      if (fType == kFloatLike) {
-	double a = boost::lexical_cast<double>(val1);
-	double b = boost::lexical_cast<double>(val2);
-	return (a <= b);
-      }
-      
-      if (fType == kString) 
-	return (val1 <= val2);
-      
-      if (fType == kTimeStamp) {
-	std::string a, b;
-	if (this->Get(a) && c.Get(b)) {
-	  time_t tta, ttb;
-	  if (nutools::dbi::Util::TimeAsStringToTime_t(a,tta) && 
-	      nutools::dbi::Util::TimeAsStringToTime_t(b,ttb) ) 
-	    return (tta <= ttb);
-	}
-	else 
-	  return false;
-      }
-      
-      if (fType == kDateStamp) {
-	std::string a, b;
-	if (this->Get(a) && c.Get(b)) {
-	  time_t tta, ttb;
-	  if (nutools::dbi::Util::DateAsStringToTime_t(a,tta) && 
-	      nutools::dbi::Util::DateAsStringToTime_t(b,ttb) ) 
-	    return (tta <= ttb);
-	}
-	else 
-	  return false;
-      }
-      
-      return false;
-      
+      int cmp;
+      return (Compare(c,cmp) && cmp <= 0);
     }
-
+    
     //************************************************************
     bool Column::operator < (const Column& c) const
     {
-      if (c.fType != fType) return false;
-      
-      std::string val1 = fValue;
-      std::string val2 = c.fValue;
-      
-      if (fType == kBool) {
-	bool a = (val1 == "1");
-	bool b = (val2 == "1");
-	return (!a&b);
-      }
-      
-      if (fType == kIntLike) {
-	long a = boost::lexical_cast<long>(val1);
-	long b = boost::lexical_cast<long>(val2);
-	return (a < b);
-      }
-      
-      if (fType == kFloatLike) {
-	double a = boost::lexical_cast<double>(val1);
-	double b = boost::lexical_cast<double>(val2);
-	return (a < b);
-      }
-      
-      if (fType == kString) 
-	return (val1 < val2);
-      
-      if (fType == kTimeStamp) {
-	std::string a, b;
-	if (this->Get(a) && c.Get(b)) {
-	  time_t tta, ttb;
-	  if (nutools::dbi::Util::TimeAsStringToTime_t(a,tta) && 
-	      nutools::dbi::Util::TimeAsStringToTime_t(b,ttb) ) 
-	    return (tta < ttb);
-	}
-	else 
-	  return false;
-      }
-      
-      if (fType == kDateStamp) {
-	std::string a, b;
-	if (this->Get(a) && c.Get(b)) {
-	  time_t tta, ttb;
-	  if (nutools::dbi::Util::DateAsStringToTime_t(a,tta) && 
-	      nutools::dbi::Util::DateAsStringToTime_t(b,ttb) ) 
-	    return (tta < ttb);
-	}
-	else 
-	  return false;
-      }
-      
-      return false;
-      
+      int cmp;
+      return (Compare(c,cmp) && cmp < 0);
     }
+
     //************************************************************
     bool Column::operator == (const Column& c) const
     {
       if (c.fType != fType) return false;
 
-      if (fValue == 0 && (fValue==c.fValue)) return true;
+      if (IsNull() || c.IsNull()) return (IsNull() && c.IsNull());
+
+      int cmp;
+      if (Compare(c,cmp)) return (cmp == 0);
+
+      // values that cannot be parsed are only equal to themselves
+      if (fValue && c.fValue) return (strcmp(fValue,c.fValue)==0);
 
-      return (strcmp(fValue,c.fValue)==0);
+      return (Value() == c.Value());
       
     }
   }
@@ -3,10 +3,15 @@
 
 #include <string>
 #include <vector>
+#include <cstring>
+#include <type_traits>
 #include <stdint.h>
 #include <iostream>
 #include <boost/lexical_cast.hpp>
 
+#include "nuevdb/IFDatabase/Arena.h"
+#include "nuevdb/IFDatabase/ColumnStore.h"
+
 namespace nutools {
   namespace dbi {
 
@@ -32,58 +37,90 @@ namespace nutools {
     class Column 
     {
     public:
-      Column() {fValue=0; fType=kIntLike;};
+      Column() {fValue=0; fOwned=true; fType=kIntLike; fStore=0; fStoreRow=0; fStoreCol=0; fKeyState=kKeyUnknown;};
       Column(const ColumnDef& c);
       Column(const Column& c);
+      Column(Column&& c) noexcept;
       ~Column();
+
+      Column& operator=(const Column& c);
+      Column& operator=(Column&& c) noexcept;
       
       uint8_t Type()          const { return fType;}
       std::string Value()     const { 
-	if (!fValue) return std::string("");
-	else return std::string(fValue); }
-      bool        IsNull()    const { return (!fValue); }
+	if (fValue) return std::string(fValue);
+	if (fStore) return fStore->GetString(fStoreRow,fStoreCol);
+	return std::string(""); }
+      bool        IsNull()    const {
+	return (!fValue && (!fStore || fStore->IsNull(fStoreRow,fStoreCol))); }
       bool        Modified()  const { return fModified; }
+      /// Bytes of heap held by the value; arena and store values are
+      /// accounted for by their owners
+      size_t      HeapSize()  const {
+	return ((fValue && fOwned) ? strlen(fValue)+1 : 0); }
       
       void        Clear();
 
-      void        SetType(uint8_t t) { fType = t; }
+      void        SetType(uint8_t t) { fType = t; fKeyState = kKeyUnknown; }
 
       // WARNING: the casual user should NOT use this method.  Only use it
       // if you _really_ know what you're doing!
       void        FastSet(std::string v) {
-	if (fValue) {
-	  delete fValue;
-	  fValue=0;
-	}
+	fStore=0;
+	FreeValue();
 	fValue = new char[v.length()+1];
 	strcpy(fValue,v.c_str());
       }
 
       void        FastSet(const char* v) {
-	if (fValue) {
-	  delete fValue;
-	  fValue=0;
-	}
+	fStore=0;
+	FreeValue();
 	fValue = new char[strlen(v)+1];
 	strcpy(fValue,v);
       }
 
+      // As above, but the value is copied into (and owned by) the arena,
+      // which must outlive this column.  Copies of this column get their
+      // own heap copy of the value.
+      void        FastSet(const char* v, size_t len, Arena& arena) {
+	fStore=0;
+	FreeValue();
+	fValue = arena.CopyString(v,len);
+	fOwned = false;
+      }
+
+      // Make this column a read-only view of a value held in a
+      // ColumnStore; any subsequent Set() detaches it again, and copies
+      // of it hold a copy of the value instead.
+      // WARNING: the casual user should NOT use this method either.
+      void        SetView(const ColumnStore* s, unsigned int irow,
+			  unsigned int icol) {
+	FreeValue();
+	fStore = s;
+	fStoreRow = irow;
+	fStoreCol = icol;
+      }
+
       template <class T>
 	bool Get(T& val) const { 
+	if (!fValue && fStore)
+	  return fStore->Get(fStoreRow,fStoreCol,val);
 	if (fValue) {
-	  try {
-	    val = boost::lexical_cast<T>(std::string(fValue)); 
-	  }
-	  catch (boost::bad_lexical_cast &) {
-	    std::cerr << "Column::Get(): Bad_lexical_cast! Value = " 
-		      << fValue << std::endl;
-	    return false;
-	  }
-	  return true;
+	  if (Parse(val)) return true;
+	  std::cerr << "Column::Get(): Bad_lexical_cast! Value = " 
+		    << fValue << std::endl;
 	}
-
 	return false;
       }
+
+      /// As Get(), but returns def if the value is NULL or cannot be
+      /// converted.  Never throws or prints.
+      template <class T>
+	T GetOr(const T& def) const {
+	T val;
+	if (QuietGet(val)) return val;
+	return def;
+      }
     
       template <class T>
 	bool Set(const T& val,bool ignoreAutoIncr=false) { 
@@ -93,25 +130,24 @@ namespace nutools {
 	  return false;
 	}
 	try {	  
-	  if (fValue) {
-	    delete fValue;
-	    fValue=0;
-	  }
+	  fStore=0;
+	  FreeValue();
 	  std::string tstr = boost::lexical_cast<std::string>(val);
 	  if (tstr == "" || tstr=="NULL") {
 	    return true;
 	  }
 	  if (fType == kBool) {
-	    fValue = new char[1];
+	    fValue = new char[2];
 	    if (tstr == "TRUE" || tstr == "t" || tstr == "true" || 
 		tstr == "y" || tstr == "yes" || tstr == "1" || tstr == "on") 
 	      fValue[0] = '1';
 	    else 
               fValue[0] = '0';
+	    fValue[1] = '\0';
 	    return true;
 	  }
 	  else {
-	    fValue = new char[tstr.length()];
+	    fValue = new char[tstr.length()+1];
 	    strcpy(fValue,tstr.c_str());
 	    return true;
 	  }
@@ -140,22 +176,97 @@ namespace nutools {
       bool        operator <  (const Column& c) const;
       bool        operator == (const Column& c) const;
 
+      /// Work out the comparison key now rather than at the first
+      /// comparison, so that comparisons from then on only read this
+      /// column (see Table::Freeze())
+      void        FillKeyNow() const { if (fKeyState == kKeyUnknown) FillKey(); }
+
     private:
+      enum KeyState {
+	kKeyUnknown,
+	kKeyInvalid,   ///< NULL or unparseable; compares false to anything
+	kKeyInt,       ///< ints, bools, microseconds for timestamps and
+	               ///< time_t for dates
+	kKeyDouble
+      };
+
+      void        FillKey() const;
+      bool        Compare(const Column& c, int& cmp) const;
+
+      template <class T>
+	bool QuietGet(T& val) const {
+	if (!fValue && fStore)
+	  return fStore->Get(fStoreRow,fStoreCol,val);
+	return (fValue && Parse(val));
+      }
+
+      // Numbers and bools are parsed in place with std::from_chars, so
+      // the common cases never allocate or throw; anything else goes
+      // through lexical_cast as before.
+      template <class T>
+	bool Parse(T& val) const {
+	if constexpr (std::is_same<T,bool>::value)
+	  return ColumnStore::ParseBool(fValue,strlen(fValue),val);
+	else if constexpr (ColumnStore::kIsNumber<T>)
+	  return ColumnStore::ParseNumber(fValue,strlen(fValue),val);
+	else if constexpr (std::is_same<T,std::string>::value) {
+	  val = fValue;
+	  return true;
+	}
+	else {
+	  try {
+	    val = boost::lexical_cast<T>(std::string(fValue)); 
+	  }
+	  catch (boost::bad_lexical_cast &) {
+	    return false;
+	  }
+	  return true;
+	}
+      }
+
+      void        CopyValue(const Column& c);
+
+      void        FreeValue() {
+	if (fValue && fOwned) delete[] fValue;
+	fValue = 0;
+	fOwned = true;
+	fKeyState = kKeyUnknown;
+      }
+
       bool        fModified;
+      bool        fOwned;    ///< false if fValue lives in an Arena
       uint16_t    fType;
       char* fValue;
+      const ColumnStore* fStore;
+      unsigned int fStoreRow;
+      uint16_t    fStoreCol;
+
+      // Comparison key, parsed from the value the first time the column
+      // is compared (or by FillKeyNow()) and dropped whenever the value
+      // changes.  Filling it is not thread safe.
+      mutable uint8_t fKeyState;
+      mutable union {
+	int64_t i;
+	double  d;
+      } fKey;
 
     }; // class end
 
     //************************************************************
     
     inline std::ostream& operator<< (std::ostream& stream, const Column& col) { 
-      if (!col.fValue) {
+      if (col.IsNull()) {
 	stream << "NULL";
       }
       else {
+	std::string sv;
+	const char* v = col.fValue;
+	if (!v) {
+	  sv = col.fStore->GetString(col.fStoreRow,col.fStoreCol);
+	  v = sv.c_str();
+	}
 	if (col.fType == kBool) {
-	  if (col.fValue[0] == '1')
+	  if (v[0] == '1')
 	    stream << "true";
 	  else
 	    stream << "false";
@@ -165,7 +276,7 @@ namespace nutools {
 			      col.fType == kTimeStamp || 
 			      col.fType == kDateStamp );
 	  if (needsQuotes)	stream << "\'";
-	  stream << col.fValue;
+	  stream << v;
 	  if (needsQuotes)	stream << "\'";
 	}
       }
@@ -0,0 +1,617 @@
+#include <charconv>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <nuevdb/IFDatabase/ColumnStore.h>
+#include <nuevdb/IFDatabase/ColumnDef.h>
+
+namespace {
+
+  //************************************************************
+  // Date arithmetic on the proleptic Gregorian calendar, so that
+  // timestamps can be converted without going through struct tm
+  //************************************************************
+  int64_t DaysFromCivil(int64_t y, unsigned m, unsigned d)
+  {
+    y -= (m <= 2);
+    const int64_t era = (y >= 0 ? y : y-399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153*(m > 2 ? m-3 : m+9) + 2)/5 + d-1;
+    const unsigned doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+  }
+
+  void CivilFromDays(int64_t z, int& y, unsigned& m, unsigned& d)
+  {
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned)(z - era * 146097);
+    const unsigned yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    const unsigned doy = doe - (365*yoe + yoe/4 - yoe/100);
+    const unsigned mp = (5*doy + 2)/153;
+    d = doy - (153*mp+2)/5 + 1;
+    m = (mp < 10 ? mp+3 : mp-9);
+    y = (int)(yoe + era * 400 + (m <= 2));
+  }
+
+  //************************************************************
+  bool ParseUInt(const char*& p, const char* end, unsigned& val)
+  {
+    std::from_chars_result r = std::from_chars(p,end,val);
+    if (r.ec != std::errc() || r.ptr == p) return false;
+    p = r.ptr;
+    return true;
+  }
+
+  //************************************************************
+  // Accepts "YYYY-MM-DD" and "YYYY/MM/DD", the same forms as
+  // Util::DateAsStringToTime_t
+  //************************************************************
+  bool ParseDate(const char*& p, const char* end, int64_t& days)
+  {
+    unsigned y, m, d;
+    if (!ParseUInt(p,end,y) || p == end || (*p != '-' && *p != '/'))
+      return false;
+    char sep = *p++;
+    if (!ParseUInt(p,end,m) || p == end || *p++ != sep) return false;
+    if (!ParseUInt(p,end,d)) return false;
+    if (m < 1 || m > 12 || d < 1 || d > 31) return false;
+    days = DaysFromCivil(y,m,d);
+    return true;
+  }
+
+  //************************************************************
+  // Accepts "YYYY-MM-DD HH:MM:SS[.ffffff]", the form returned by
+  // postgres, as well as the '/' and 'T' separated variants
+  //************************************************************
+  bool ParseTimeStamp(const char* p, const char* end, int64_t& usec)
+  {
+    int64_t days;
+    unsigned hh, mm, ss;
+    if (!ParseDate(p,end,days)) return false;
+    if (p == end || (*p != ' ' && *p != 'T')) return false;
+    ++p;
+    if (!ParseUInt(p,end,hh) || p == end || *p++ != ':') return false;
+    if (!ParseUInt(p,end,mm) || p == end || *p++ != ':') return false;
+    if (!ParseUInt(p,end,ss)) return false;
+    if (hh > 24 || mm > 59 || ss > 60) return false;
+
+    int64_t frac = 0;
+    if (p != end && *p == '.') {
+      ++p;
+      int ndig = 0;
+      for ( ; p != end && *p >= '0' && *p <= '9'; ++p, ++ndig)
+        if (ndig < 6) frac = frac*10 + (*p - '0');
+      if (ndig == 0) return false;
+      for ( ; ndig < 6; ++ndig) frac *= 10;
+    }
+    if (p != end) return false;
+
+    usec = ((days*24 + hh)*60 + mm)*60 + ss;
+    usec = usec*1000000 + frac;
+    return true;
+  }
+
+  //************************************************************
+  int StoreTypeOf(const std::string& t)
+  {
+    if (t == "short" || t == "smallint" || t == "int" || t == "integer" ||
+        t == "long" || t == "bigint" || t == "autoincr" ||
+        t == "auto_incr")
+      return nutools::dbi::ColumnStore::kStoreInt;
+    if (t == "double" || t == "double precision")
+      return nutools::dbi::ColumnStore::kStoreDouble;
+    if (t == "float" || t == "real")
+      return nutools::dbi::ColumnStore::kStoreFloat;
+    if (t == "bool" || t == "boolean")
+      return nutools::dbi::ColumnStore::kStoreBool;
+    if (t == "timestamp")
+      return nutools::dbi::ColumnStore::kStoreTime;
+    if (t == "date")
+      return nutools::dbi::ColumnStore::kStoreDate;
+    return nutools::dbi::ColumnStore::kStoreText;
+  }
+
+  //************************************************************
+  // Point array a at the n elements of section s, if that is their size
+  //************************************************************
+  template <class A>
+    bool ViewSection(const nutools::dbi::ColumnStore::Section& s, size_t n,
+                     A& a)
+    {
+      typedef typename std::remove_cv<
+        typename std::remove_reference<decltype(*a.data())>::type>::type T;
+      if (s.second != n*sizeof(T)) return false;
+      a.view(static_cast<const T*>(s.first),n);
+      return true;
+    }
+
+}
+
+//************************************************************
+namespace nutools {
+  namespace dbi {
+
+    ColumnStore::ColumnStore() : fNRow(0)
+    {
+    }
+
+    //************************************************************
+
+    ColumnStore::~ColumnStore()
+    {
+    }
+
+    //************************************************************
+    bool ColumnStore::ParseBool(const char* v, size_t len, bool& val)
+    {
+      if (len == 1) {   // what we store ourselves, and what postgres returns
+        if (*v == '1' || *v == 't') { val = true; return true; }
+        if (*v == '0' || *v == 'f') { val = false; return true; }
+      }
+      if (len == 0 || len > 5) return false;
+      char buf[6];
+      for (size_t i=0; i<len; ++i) buf[i] = tolower(v[i]);
+      buf[len] = '\0';
+      if (!strcmp(buf,"1") || !strcmp(buf,"t") || !strcmp(buf,"true") ||
+          !strcmp(buf,"y") || !strcmp(buf,"yes") || !strcmp(buf,"on")) {
+        val = true;
+        return true;
+      }
+      if (!strcmp(buf,"0") || !strcmp(buf,"f") || !strcmp(buf,"false") ||
+          !strcmp(buf,"n") || !strcmp(buf,"no") || !strcmp(buf,"off")) {
+        val = false;
+        return true;
+      }
+      return false;
+    }
+
+    //************************************************************
+    size_t ColumnStore::FormatDate(int64_t days, char* buf)
+    {
+      int y;
+      unsigned m, d;
+      CivilFromDays(days,y,m,d);
+      return snprintf(buf,64,"%04d-%02u-%02u",y,m,d);
+    }
+
+    //************************************************************
+    size_t ColumnStore::FormatTime(int64_t usec, char* buf)
+    {
+      int64_t days = usec/86400000000LL;
+      usec %= 86400000000LL;
+      if (usec < 0) { usec += 86400000000LL; --days; }
+
+      size_t n = FormatDate(days,buf);
+      int64_t sec = usec/1000000;
+      int frac = usec%1000000;
+      n += snprintf(buf+n,64-n," %02d:%02d:%02d",
+                    int(sec/3600),int((sec/60)%60),int(sec%60));
+      if (frac) {
+        n += snprintf(buf+n,64-n,".%06d",frac);
+        while (buf[n-1] == '0') --n;
+      }
+      return n;
+    }
+
+    //************************************************************
+    void ColumnStore::Reset(const std::vector<ColumnDef>& cols)
+    {
+      fData.clear();
+      fData.resize(cols.size());
+      for (unsigned int i=0; i<cols.size(); ++i)
+        fData[i].fType = StoreTypeOf(cols[i].Type());
+
+      fNRow = 0;
+      fChannel.clear();
+      fVldTime.clear();
+      fVldTimeEnd.clear();
+      fRowFlags.clear();
+      fMapping.reset();
+    }
+
+    //************************************************************
+    void ColumnStore::Clear()
+    {
+      // rebuild rather than resize so that the memory is released
+      std::vector<Data> data(fData.size());
+      for (unsigned int i=0; i<fData.size(); ++i)
+        data[i].fType = fData[i].fType;
+      fData.swap(data);
+
+      fNRow = 0;
+      fChannel.release();
+      fVldTime.release();
+      fVldTimeEnd.release();
+      fRowFlags.release();
+      fMapping.reset();
+    }
+
+    //************************************************************
+    void ColumnStore::ResizeData(Data& d, unsigned int nrow)
+    {
+      d.fNull.resize(nrow,1);
+      switch (d.fType) {
+      case kStoreInt:
+      case kStoreTime:
+      case kStoreDate:
+        d.fInt.resize(nrow,0);
+        break;
+      case kStoreDouble:
+        d.fDouble.resize(nrow,0.);
+        break;
+      case kStoreFloat:
+        d.fFloat.resize(nrow,0.);
+        break;
+      case kStoreBool:
+        d.fBool.resize(nrow,0);
+        break;
+      default:
+        d.fOffset.resize(nrow,0);
+        d.fLength.resize(nrow,0);
+      }
+    }
+
+    //************************************************************
+    void ColumnStore::Resize(unsigned int nrow)
+    {
+      for (unsigned int i=0; i<fData.size(); ++i)
+        ResizeData(fData[i],nrow);
+
+      fChannel.resize(nrow,0xffffffff);
+      fVldTime.resize(nrow,0.);
+      fVldTimeEnd.resize(nrow,0.);
+      fRowFlags.resize(nrow,0);
+
+      fNRow = nrow;
+    }
+
+    //************************************************************
+    void ColumnStore::SetNull(unsigned int irow, unsigned int icol)
+    {
+      fData[icol].fNull[irow] = 1;
+    }
+
+    //************************************************************
+    void ColumnStore::SetInt(unsigned int irow, unsigned int icol, int64_t v)
+    {
+      Data& d = fData[icol];
+      if (d.fType == kStoreDouble || d.fType == kStoreFloat) {
+        SetDouble(irow,icol,v);
+        return;
+      }
+      if (d.fType != kStoreInt) {
+        std::string s = std::to_string(v);
+        SetFromString(irow,icol,s);
+        return;
+      }
+      d.fInt[irow] = v;
+      d.fNull[irow] = 0;
+    }
+
+    //************************************************************
+    void ColumnStore::SetDouble(unsigned int irow, unsigned int icol, double v)
+    {
+      Data& d = fData[icol];
+      if (d.fType == kStoreDouble)
+        d.fDouble[irow] = v;
+      else if (d.fType == kStoreFloat)
+        d.fFloat[irow] = v;
+      else {
+        char buf[64];
+        std::to_chars_result r = std::to_chars(buf,buf+sizeof(buf),v);
+        SetFromString(irow,icol,buf,r.ptr-buf);
+        return;
+      }
+      d.fNull[irow] = 0;
+    }
+
+    //************************************************************
+    void ColumnStore::SetBool(unsigned int irow, unsigned int icol, bool v)
+    {
+      Data& d = fData[icol];
+      if (d.fType != kStoreBool) {
+        SetFromString(irow,icol,(v ? "1" : "0"),1);
+        return;
+      }
+      d.fBool[irow] = v;
+      d.fNull[irow] = 0;
+    }
+
+    //************************************************************
+    void ColumnStore::SetTime(unsigned int irow, unsigned int icol,
+                              int64_t usec)
+    {
+      Data& d = fData[icol];
+      if (d.fType != kStoreTime) {
+        char buf[64];
+        SetFromString(irow,icol,buf,FormatTime(usec,buf));
+        return;
+      }
+      d.fInt[irow] = usec;
+      d.fNull[irow] = 0;
+    }
+
+    //************************************************************
+    void ColumnStore::SetDate(unsigned int irow, unsigned int icol,
+                              int64_t days)
+    {
+      Data& d = fData[icol];
+      if (d.fType != kStoreDate) {
+        char buf[64];
+        SetFromString(irow,icol,buf,FormatDate(days,buf));
+        return;
+      }
+      d.fInt[irow] = days;
+      d.fNull[irow] = 0;
+    }
+
+    //************************************************************
+    void ColumnStore::SetText(unsigned int irow, unsigned int icol,
+                              const char* v, size_t len)
+    {
+      Data& d = fData[icol];
+      if (d.fType != kStoreText) DemoteToText(icol);
+      d.fOffset[irow] = d.fBlob.size();
+      d.fLength[irow] = len;
+      d.fBlob.append(v,len);
+      d.fNull[irow] = 0;
+    }
+
+    //************************************************************
+    bool ColumnStore::SetFromString(unsigned int irow, unsigned int icol,
+                                    const char* v, size_t len)
+    {
+      Data& d = fData[icol];
+      const int type = d.fType;
+      bool isOk = false;
+
+      switch (type) {
+      case kStoreInt:
+        isOk = ParseNumber(v,len,d.fInt[irow]);
+        break;
+      case kStoreDouble:
+        isOk = ParseNumber(v,len,d.fDouble[irow]);
+        break;
+      case kStoreFloat:
+        isOk = ParseNumber(v,len,d.fFloat[irow]);
+        break;
+      case kStoreBool: {
+        bool b;
+        isOk = ParseBool(v,len,b);
+        if (isOk) d.fBool[irow] = b;
+        break;
+      }
+      case kStoreTime:
+        isOk = ParseTimeStamp(v,v+len,d.fInt[irow]);
+        break;
+      case kStoreDate: {
+        const char* p = v;
+        isOk = (ParseDate(p,v+len,d.fInt[irow]) && p == v+len);
+        break;
+      }
+      default:
+        break;
+      }
+
+      if (isOk) {
+        d.fNull[irow] = 0;
+        return true;
+      }
+
+      // either this is a text column, or the value does not look like
+      // the declared type; in the latter case keep the column as text
+      // so that the value is preserved exactly
+      SetText(irow,icol,v,len);
+      return (type == kStoreText);
+    }
+
+    //************************************************************
+    void ColumnStore::DemoteToText(unsigned int icol)
+    {
+      Data& d = fData[icol];
+      if (d.fType == kStoreText) return;
+
+      Data text;
+      text.fType = kStoreText;
+      ResizeData(text,fNRow);
+      for (unsigned int i=0; i<fNRow; ++i) {
+        if (d.fNull[i]) continue;
+        std::string s = GetString(i,icol);
+        text.fOffset[i] = text.fBlob.size();
+        text.fLength[i] = s.length();
+        text.fBlob.append(s.data(),s.length());
+        text.fNull[i] = 0;
+      }
+      std::swap(d,text);
+    }
+
+    //************************************************************
+    double ColumnStore::GetDouble(unsigned int irow, unsigned int icol) const
+    {
+      const Data& d = fData[icol];
+      switch (d.fType) {
+      case kStoreInt:    return d.fInt[irow];
+      case kStoreDouble: return d.fDouble[irow];
+      case kStoreFloat:  return d.fFloat[irow];
+      case kStoreBool:   return d.fBool[irow];
+      case kStoreTime:   return d.fInt[irow]/1.e6;
+      case kStoreDate:   return d.fInt[irow]*86400.;
+      default:
+        return strtod(GetString(irow,icol).c_str(),NULL);
+      }
+    }
+
+    //************************************************************
+    const char* ColumnStore::GetText(unsigned int irow, unsigned int icol,
+                                     size_t& len) const
+    {
+      const Data& d = fData[icol];
+      if (d.fType != kStoreText || d.fNull[irow]) {
+        len = 0;
+        return 0;
+      }
+      len = d.fLength[irow];
+      return d.fBlob.data() + d.fOffset[irow];
+    }
+
+    //************************************************************
+    std::string ColumnStore::GetString(unsigned int irow,
+                                       unsigned int icol) const
+    {
+      const Data& d = fData[icol];
+      if (d.fNull[irow]) return std::string("");
+
+      char buf[64];
+      std::to_chars_result r;
+      r.ptr = buf;
+
+      switch (d.fType) {
+      case kStoreInt:
+        r = std::to_chars(buf,buf+sizeof(buf),d.fInt[irow]);
+        break;
+      case kStoreDouble:
+        r = std::to_chars(buf,buf+sizeof(buf),d.fDouble[irow]);
+        break;
+      case kStoreFloat:
+        r = std::to_chars(buf,buf+sizeof(buf),d.fFloat[irow]);
+        break;
+      case kStoreBool:
+        buf[0] = (d.fBool[irow] ? '1' : '0');
+        r.ptr = buf+1;
+        break;
+      case kStoreTime:
+        r.ptr = buf + FormatTime(d.fInt[irow],buf);
+        break;
+      case kStoreDate:
+        r.ptr = buf + FormatDate(d.fInt[irow],buf);
+        break;
+      default:
+        return std::string(d.fBlob.data()+d.fOffset[irow],d.fLength[irow]);
+      }
+
+      return std::string(buf,r.ptr);
+    }
+
+    //************************************************************
+    size_t ColumnStore::MemoryUsage() const
+    {
+      size_t n = fData.capacity()*sizeof(Data);
+      for (unsigned int i=0; i<fData.size(); ++i) {
+        const Data& d = fData[i];
+        n += (d.fNull.HeapSize() + d.fInt.HeapSize() + d.fDouble.HeapSize() +
+              d.fFloat.HeapSize() + d.fBool.HeapSize() +
+              d.fOffset.HeapSize() + d.fLength.HeapSize() +
+              d.fBlob.HeapSize());
+      }
+      n += (fChannel.HeapSize() + fVldTime.HeapSize() +
+            fVldTimeEnd.HeapSize() + fRowFlags.HeapSize());
+      return n;
+    }
+
+    //************************************************************
+    void ColumnStore::GetSections(std::vector<Section>& sect) const
+    {
+      sect.clear();
+      sect.push_back(Section(fChannel.data(),fNRow*sizeof(uint64_t)));
+      sect.push_back(Section(fVldTime.data(),fNRow*sizeof(double)));
+      sect.push_back(Section(fVldTimeEnd.data(),fNRow*sizeof(double)));
+      sect.push_back(Section(fRowFlags.data(),fNRow*sizeof(uint8_t)));
+
+      for (unsigned int i=0; i<fData.size(); ++i) {
+        const Data& d = fData[i];
+        sect.push_back(Section(d.fNull.data(),fNRow*sizeof(uint8_t)));
+        switch (d.fType) {
+        case kStoreInt:
+        case kStoreTime:
+        case kStoreDate:
+          sect.push_back(Section(d.fInt.data(),fNRow*sizeof(int64_t)));
+          break;
+        case kStoreDouble:
+          sect.push_back(Section(d.fDouble.data(),fNRow*sizeof(double)));
+          break;
+        case kStoreFloat:
+          sect.push_back(Section(d.fFloat.data(),fNRow*sizeof(float)));
+          break;
+        case kStoreBool:
+          sect.push_back(Section(d.fBool.data(),fNRow*sizeof(uint8_t)));
+          break;
+        default:
+          sect.push_back(Section(d.fOffset.data(),fNRow*sizeof(uint64_t)));
+          break;
+        }
+        if (d.fType == kStoreText) {
+          sect.push_back(Section(d.fLength.data(),fNRow*sizeof(uint32_t)));
+          sect.push_back(Section(d.fBlob.data(),d.fBlob.size()));
+        }
+        else {
+          sect.push_back(Section(0,0));
+          sect.push_back(Section(0,0));
+        }
+      }
+    }
+
+    //************************************************************
+    bool ColumnStore::View(unsigned int nrow, const std::vector<int>& types,
+                           const std::vector<Section>& sect,
+                           std::shared_ptr<const void> mapping)
+    {
+      Clear();
+      if (sect.size() != 4 + 4*types.size()) return false;
+
+      std::vector<Data> data(types.size());
+      bool isOk = (ViewSection(sect[0],nrow,fChannel) &&
+                   ViewSection(sect[1],nrow,fVldTime) &&
+                   ViewSection(sect[2],nrow,fVldTimeEnd) &&
+                   ViewSection(sect[3],nrow,fRowFlags));
+
+      for (unsigned int i=0; i<types.size() && isOk; ++i) {
+        Data& d = data[i];
+        const Section* s = &sect[4+4*i];
+        d.fType = types[i];
+        isOk = ViewSection(s[0],nrow,d.fNull);
+        switch (d.fType) {
+        case kStoreInt:
+        case kStoreTime:
+        case kStoreDate:
+          isOk = isOk && ViewSection(s[1],nrow,d.fInt);
+          break;
+        case kStoreDouble:
+          isOk = isOk && ViewSection(s[1],nrow,d.fDouble);
+          break;
+        case kStoreFloat:
+          isOk = isOk && ViewSection(s[1],nrow,d.fFloat);
+          break;
+        case kStoreBool:
+          isOk = isOk && ViewSection(s[1],nrow,d.fBool);
+          break;
+        case kStoreText:
+          isOk = isOk && ViewSection(s[1],nrow,d.fOffset) &&
+            ViewSection(s[2],nrow,d.fLength) &&
+            ViewSection(s[3],s[3].second,d.fBlob);
+          // every value must lie inside the blob, or reading it would
+          // run off the end of the mapping
+          for (unsigned int j=0; j<nrow && isOk; ++j)
+            isOk = (d.fOffset[j] <= d.fBlob.size() &&
+                    d.fLength[j] <= d.fBlob.size() - d.fOffset[j]);
+          break;
+        default:
+          isOk = false;
+        }
+      }
+
+      if (!isOk) {
+        Clear();
+        return false;
+      }
+
+      fData.swap(data);
+      fNRow = nrow;
+      fMapping = mapping;
+      return true;
+    }
+
+  }
+}
@@ -0,0 +1,305 @@
+#ifndef __DBICOLUMNSTORE_HPP_
+#define __DBICOLUMNSTORE_HPP_
+
+#include <charconv>
+#include <string>
+#include <vector>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <stdint.h>
+#include <boost/lexical_cast.hpp>
+
+namespace nutools {
+  namespace dbi {
+
+    class ColumnDef;
+
+    /**
+     * Column-major, typed storage for the values of a loaded Table.
+     *
+     * Each ColumnDef gets one contiguous array of its native type
+     * (int64, double, float, bool, timestamp or date); text columns are
+     * kept as offset/length pairs into a single blob.  Values are parsed
+     * once, when they are loaded, rather than on every access.  If a
+     * value cannot be parsed as the declared type the whole column falls
+     * back to text storage, so nothing is ever lost.
+     *
+     * The arrays can also be read-only views of memory held elsewhere,
+     * such as a mapped snapshot file (see Table::MapSnapshot()); the
+     * first write to such an array makes a private copy of it.
+     */
+    class ColumnStore
+    {
+    public:
+      enum StoreType {
+        kStoreInt,
+        kStoreDouble,
+        kStoreFloat,
+        kStoreBool,
+        kStoreTime,  ///< microseconds since the epoch
+        kStoreDate,  ///< days since the epoch
+        kStoreText
+      };
+
+      ColumnStore();
+      ~ColumnStore();
+
+      /// Text -> value conversions shared with Column::Get().  They
+      /// never allocate or throw; the whole of v must be consumed.
+      static bool ParseBool(const char* v, size_t len, bool& val);
+      template <class T>
+        static bool ParseNumber(const char* v, size_t len, T& val);
+
+      /// Write a time (microseconds since the epoch) or date (days since
+      /// the epoch) the way postgres prints it; returns the length.
+      /// buf must hold at least 64 chars.
+      static size_t FormatTime(int64_t usec, char* buf);
+      static size_t FormatDate(int64_t days, char* buf);
+
+      /// Arithmetic types that are parsed as numbers.  The character
+      /// types are left out since lexical_cast treats them as characters.
+      template <class T>
+        static constexpr bool kIsNumber = (std::is_arithmetic<T>::value &&
+                                           !std::is_same<T,bool>::value &&
+                                           !std::is_same<T,char>::value &&
+                                           !std::is_same<T,signed char>::value &&
+                                           !std::is_same<T,unsigned char>::value);
+
+      void Reset(const std::vector<ColumnDef>& cols);
+      void Clear();
+      void Resize(unsigned int nrow);
+
+      unsigned int NRow() const { return fNRow; }
+      unsigned int NCol() const { return fData.size(); }
+      int  Type(unsigned int icol) const { return fData[icol].fType; }
+
+      bool IsNull(unsigned int irow, unsigned int icol) const
+      { return fData[icol].fNull[irow]; }
+
+      bool SetFromString(unsigned int irow, unsigned int icol,
+                         const char* v, size_t len);
+      bool SetFromString(unsigned int irow, unsigned int icol,
+                         const std::string& v)
+      { return SetFromString(irow,icol,v.data(),v.length()); }
+
+      void SetNull(unsigned int irow, unsigned int icol);
+      void SetInt(unsigned int irow, unsigned int icol, int64_t v);
+      void SetDouble(unsigned int irow, unsigned int icol, double v);
+      void SetBool(unsigned int irow, unsigned int icol, bool v);
+      void SetTime(unsigned int irow, unsigned int icol, int64_t usec);
+      void SetDate(unsigned int irow, unsigned int icol, int64_t days);
+      void SetText(unsigned int irow, unsigned int icol,
+                   const char* v, size_t len);
+
+      int64_t GetInt(unsigned int irow, unsigned int icol) const
+      { return fData[icol].fInt[irow]; }
+      double  GetDouble(unsigned int irow, unsigned int icol) const;
+      bool    GetBool(unsigned int irow, unsigned int icol) const
+      { return fData[icol].fBool[irow]; }
+      const char* GetText(unsigned int irow, unsigned int icol,
+                          size_t& len) const;
+
+      std::string GetString(unsigned int irow, unsigned int icol) const;
+
+      /// A raw array of the store: address and size in bytes
+      typedef std::pair<const void*,size_t> Section;
+
+      /// All arrays of the store in a fixed order: the row channels,
+      /// validity times, validity end times and flags, then for each
+      /// column its null flags, values, text lengths and text blob (the
+      /// last two are empty unless the column is kStoreText).
+      void GetSections(std::vector<Section>& sect) const;
+
+      /// Make the store a read-only view of arrays laid out as by
+      /// GetSections(), for nrow rows and columns of the given store
+      /// types.  mapping is kept for as long as the arrays are in use.
+      /// False, leaving the store empty, if a size does not match.
+      bool View(unsigned int nrow, const std::vector<int>& types,
+                const std::vector<Section>& sect,
+                std::shared_ptr<const void> mapping);
+      bool IsView() const { return (bool)fMapping; }
+
+      /// Bytes of heap held by the arrays.  Views count for nothing,
+      /// since what they show is held by the page cache.
+      size_t MemoryUsage() const;
+
+      template <class T>
+        bool Get(unsigned int irow, unsigned int icol, T& val) const;
+
+      void     SetChannel(unsigned int irow, uint64_t ch)
+      { fChannel[irow] = ch; fRowFlags[irow] |= kVldRow; }
+      void     SetVldTime(unsigned int irow, double t)
+      { fVldTime[irow] = t; fRowFlags[irow] |= kVldRow; }
+      void     SetVldTimeEnd(unsigned int irow, double t)
+      { fVldTimeEnd[irow] = t; fRowFlags[irow] |= (kVldRow|kHasVldTimeEnd); }
+      void     SetInDB(unsigned int irow) { fRowFlags[irow] |= kInDB; }
+
+      uint64_t Channel(unsigned int irow) const { return fChannel[irow]; }
+      double   VldTime(unsigned int irow) const { return fVldTime[irow]; }
+      double   VldTimeEnd(unsigned int irow) const { return fVldTimeEnd[irow]; }
+      bool     IsVldRow(unsigned int irow) const
+      { return (fRowFlags[irow] & kVldRow); }
+      bool     HasVldTimeEnd(unsigned int irow) const
+      { return (fRowFlags[irow] & kHasVldTimeEnd); }
+      bool     InDB(unsigned int irow) const
+      { return (fRowFlags[irow] & kInDB); }
+
+    private:
+
+      /// An array that is either owned or a view of someone else's
+      /// memory.  Reads go through one pointer either way; anything that
+      /// may write makes the array owned first.
+      template <class T>
+        class Array {
+      public:
+        Array() : fPtr(0), fSize(0), fIsView(false) {}
+        Array(const Array& a) : fVec(a.fVec) { Point(a); }
+        Array(Array&& a) noexcept : fVec(std::move(a.fVec)) { Point(a); a.clear(); }
+        Array& operator=(const Array& a)
+        { if (this != &a) { fVec = a.fVec; Point(a); } return *this; }
+        Array& operator=(Array&& a) noexcept
+        { if (this != &a) { fVec = std::move(a.fVec); Point(a); a.clear(); }
+          return *this; }
+
+        size_t   size() const { return fSize; }
+        size_t   HeapSize() const { return fVec.capacity()*sizeof(T); }
+        const T* data() const { return fPtr; }
+        const T& operator[](size_t i) const { return fPtr[i]; }
+        T&       operator[](size_t i) { Own(); return fVec[i]; }
+
+        void resize(size_t n, const T& v)
+        { Own(); fVec.resize(n,v); fPtr = fVec.data(); fSize = n; }
+        void append(const T* v, size_t n)
+        { Own(); fVec.insert(fVec.end(),v,v+n);
+          fPtr = fVec.data(); fSize = fVec.size(); }
+        void clear() { fVec.clear(); fPtr = 0; fSize = 0; fIsView = false; }
+        void release() { std::vector<T>().swap(fVec); clear(); }
+        void view(const T* v, size_t n)
+        { release(); fPtr = v; fSize = n; fIsView = true; }
+
+      private:
+        void Point(const Array& a) {
+          fIsView = a.fIsView;
+          fPtr = (fIsView ? a.fPtr : fVec.data());
+          fSize = a.fSize;
+        }
+        void Own() {
+          if (!fIsView) return;
+          fVec.assign(fPtr,fPtr+fSize);
+          fPtr = fVec.data();
+          fIsView = false;
+        }
+
+        std::vector<T> fVec;
+        const T* fPtr;
+        size_t   fSize;
+        bool     fIsView;
+      };
+
+      enum RowFlag {
+        kVldRow=0x1,
+        kHasVldTimeEnd=0x2,
+        kInDB=0x4
+      };
+
+      struct Data {
+        int                   fType;
+        Array<uint8_t>        fNull;
+        Array<int64_t>        fInt;     ///< kStoreInt, kStoreTime, kStoreDate
+        Array<double>         fDouble;
+        Array<float>          fFloat;
+        Array<uint8_t>        fBool;
+        Array<uint64_t>       fOffset;  ///< kStoreText, into fBlob
+        Array<uint32_t>       fLength;
+        Array<char>           fBlob;
+      };
+
+      void DemoteToText(unsigned int icol);
+      void ResizeData(Data& d, unsigned int nrow);
+
+      unsigned int          fNRow;
+      std::vector<Data>     fData;
+
+      Array<uint64_t>       fChannel;
+      Array<double>         fVldTime;
+      Array<double>         fVldTimeEnd;
+      Array<uint8_t>        fRowFlags;
+
+      std::shared_ptr<const void> fMapping; ///< what views point into
+
+    }; // class end
+
+    //************************************************************
+
+    template <class T>
+      bool ColumnStore::ParseNumber(const char* v, size_t len, T& val)
+      {
+        const char* end = v + len;
+        if (v != end && *v == '+') ++v;
+        std::from_chars_result r = std::from_chars(v,end,val);
+        return (r.ec == std::errc() && r.ptr == end && v != end);
+      }
+
+    //************************************************************
+
+    template <class T>
+      bool ColumnStore::Get(unsigned int irow, unsigned int icol, T& val) const
+      {
+        const Data& d = fData[icol];
+        if (d.fNull[irow]) return false;
+
+        if constexpr (std::is_same<T,std::string>::value) {
+          val = GetString(irow,icol);
+          return true;
+        }
+        else if constexpr (kIsNumber<T> || std::is_same<T,bool>::value) {
+          if (d.fType == kStoreInt ||
+              (d.fType == kStoreBool && !std::is_floating_point<T>::value)) {
+            int64_t v = (d.fType == kStoreInt ? d.fInt[irow] : d.fBool[irow]);
+            if constexpr (std::is_same<T,bool>::value) {
+              if (v != 0 && v != 1) return false;
+            }
+            else if constexpr (std::is_integral<T>::value) {
+              if (v < 0) {
+                if (std::is_unsigned<T>::value ||
+                    v < int64_t(std::numeric_limits<T>::min())) return false;
+              }
+              else if (uint64_t(v) > uint64_t(std::numeric_limits<T>::max()))
+                return false;
+            }
+            val = T(v);
+            return true;
+          }
+          if constexpr (std::is_floating_point<T>::value) {
+            if (d.fType == kStoreDouble) { val = T(d.fDouble[irow]); return true; }
+            if (d.fType == kStoreFloat)  { val = T(d.fFloat[irow]); return true; }
+          }
+        }
+
+        if constexpr (kIsNumber<T> || std::is_same<T,bool>::value) {
+          if (d.fType == kStoreText) {
+            size_t len;
+            const char* v = GetText(irow,icol,len);
+            if constexpr (std::is_same<T,bool>::value)
+              return ParseBool(v,len,val);
+            else
+              return ParseNumber(v,len,val);
+          }
+        }
+
+        // no direct conversion from the stored type, so do what Column
+        // would have done with the text value
+        try {
+          val = boost::lexical_cast<T>(GetString(irow,icol));
+        }
+        catch (boost::bad_lexical_cast &) {
+          return false;
+        }
+        return true;
+      }
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
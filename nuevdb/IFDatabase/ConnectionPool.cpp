@@ -0,0 +1,171 @@
+#include <chrono>
+
+#include <libpq-fe.h>
+
+#include <nuevdb/IFDatabase/ConnectionPool.h>
+
+namespace {
+  // connections idle for longer than this get a round trip to the
+  // server before being handed out again
+  const int kCheckAfter = 30;
+
+  bool IsHealthy(PGconn* conn, int idleFor)
+  {
+    if (PQstatus(conn) != CONNECTION_OK) return false;
+    if (PQtransactionStatus(conn) != PQTRANS_IDLE) return false;
+    if (idleFor < kCheckAfter) return true;
+
+    PGresult* res = PQexec(conn,"");
+    bool isOk = (PQresultStatus(res) == PGRES_EMPTY_QUERY);
+    PQclear(res);
+    return isOk;
+  }
+}
+
+//************************************************************
+namespace nutools {
+  namespace dbi {
+
+    ConnectionPool::ConnectionPool(unsigned int maxSize, int maxIdleTime) :
+      fNInUse(0), fMaxSize(maxSize), fMaxIdleTime(maxIdleTime)
+    {
+      if (fMaxSize < 1) fMaxSize = 1;
+    }
+
+    //************************************************************
+
+    ConnectionPool::~ConnectionPool()
+    {
+      Clear();
+    }
+
+    //************************************************************
+    void ConnectionPool::Clear()
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      for (std::list<IdleConn>::iterator it = fIdle.begin();
+           it != fIdle.end(); ++it)
+        PQfinish(it->conn);
+      fIdle.clear();
+      fFreed.notify_all();
+    }
+
+    //************************************************************
+    void ConnectionPool::SetMaxSize(unsigned int n)
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fMaxSize = (n < 1 ? 1 : n);
+      while (!fIdle.empty() && fIdle.size() + fNInUse > fMaxSize) {
+        PQfinish(fIdle.front().conn);
+        fIdle.pop_front();
+      }
+      fFreed.notify_all();
+    }
+
+    //************************************************************
+    void ConnectionPool::SetMaxIdleTime(int t)
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fMaxIdleTime = t;
+    }
+
+    //************************************************************
+    unsigned int ConnectionPool::NIdle()
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fIdle.size();
+    }
+
+    //************************************************************
+    unsigned int ConnectionPool::NInUse()
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fNInUse;
+    }
+
+    //************************************************************
+    // Must be called with fMutex held.
+    //************************************************************
+    void ConnectionPool::CloseExpired(time_t now)
+    {
+      while (!fIdle.empty() && now - fIdle.front().since > fMaxIdleTime) {
+        PQfinish(fIdle.front().conn);
+        fIdle.pop_front();
+      }
+    }
+
+    //************************************************************
+    bool ConnectionPool::Borrow(const std::string& key, PGconn*& conn,
+                                int timeout)
+    {
+      std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+
+      while (true) {
+        int idleFor = 0;
+        conn = 0;
+        {
+          std::unique_lock<std::mutex> lock(fMutex);
+          while (true) {
+            time_t now = time(NULL);
+            CloseExpired(now);
+
+            // most recently returned first, so that the rest can expire
+            std::list<IdleConn>::reverse_iterator it = fIdle.rbegin();
+            for ( ; it != fIdle.rend(); ++it)
+              if (it->key == key) break;
+            if (it != fIdle.rend()) {
+              conn = it->conn;
+              idleFor = now - it->since;
+              fIdle.erase(std::next(it).base());
+              ++fNInUse;
+              break;
+            }
+
+            // make room by closing an idle connection nobody asked for
+            if (fIdle.size() + fNInUse >= fMaxSize && !fIdle.empty()) {
+              PQfinish(fIdle.front().conn);
+              fIdle.pop_front();
+            }
+            if (fIdle.size() + fNInUse < fMaxSize) {
+              ++fNInUse;
+              return true;
+            }
+
+            if (fFreed.wait_until(lock,deadline) == std::cv_status::timeout)
+              return false;
+          }
+        }
+
+        if (IsHealthy(conn,idleFor)) return true;
+
+        PQfinish(conn);
+        conn = 0;
+        std::lock_guard<std::mutex> lock(fMutex);
+        --fNInUse;
+      }
+    }
+
+    //************************************************************
+    void ConnectionPool::Return(const std::string& key, PGconn* conn)
+    {
+      if (conn && (PQstatus(conn) != CONNECTION_OK ||
+                   PQtransactionStatus(conn) != PQTRANS_IDLE)) {
+        PQfinish(conn);
+        conn = 0;
+      }
+
+      std::lock_guard<std::mutex> lock(fMutex);
+      if (fNInUse > 0) --fNInUse;
+      if (conn) {
+        IdleConn ic;
+        ic.key = key;
+        ic.conn = conn;
+        ic.since = time(NULL);
+        fIdle.push_back(ic);
+      }
+      fFreed.notify_one();
+    }
+
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef __DBICONNECTIONPOOL_HPP_
+#define __DBICONNECTIONPOOL_HPP_
+
+#include <string>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <ctime>
+
+// Forward declarations for postgres types
+struct pg_conn;
+typedef pg_conn PGconn;
+
+namespace nutools {
+  namespace dbi {
+
+    /**
+     * Bounded pool of open postgres connections, shared by Tables.
+     *
+     * Connections are keyed by their connection string (host, db, port,
+     * user, password) plus the role.  Borrow() hands out an idle
+     * connection with the same key if there is one, and otherwise
+     * reserves a slot for the caller to open a new one; either way the
+     * connection goes back with Return().  Connections that come back
+     * broken or in the middle of a transaction are closed rather than
+     * kept, and idle ones are closed after MaxIdleTime() seconds.
+     *
+     * All methods are thread safe.
+     */
+    class ConnectionPool
+    {
+    public:
+      ConnectionPool(unsigned int maxSize=8, int maxIdleTime=300);
+      ~ConnectionPool();
+
+      ConnectionPool(const ConnectionPool&) = delete;
+      ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+      /// Sets conn to an idle connection for key, or to 0 if the caller
+      /// should open a new one.  Waits up to timeout seconds for a slot
+      /// if the pool is full, and returns false if none came free.
+      bool Borrow(const std::string& key, PGconn*& conn, int timeout);
+      /// Give back a connection (0 if opening it failed) from Borrow().
+      void Return(const std::string& key, PGconn* conn);
+
+      /// Close all idle connections.
+      void Clear();
+
+      void SetMaxSize(unsigned int n);
+      void SetMaxIdleTime(int t);  ///< seconds
+      unsigned int MaxSize() const { return fMaxSize; }
+      int          MaxIdleTime() const { return fMaxIdleTime; }
+
+      unsigned int NIdle();
+      unsigned int NInUse();
+
+    private:
+      struct IdleConn {
+        std::string key;
+        PGconn* conn;
+        time_t  since;
+      };
+
+      void CloseExpired(time_t now);
+
+      std::mutex fMutex;
+      std::condition_variable fFreed;
+      std::list<IdleConn> fIdle;  ///< oldest first
+      unsigned int fNInUse;
+      unsigned int fMaxSize;
+      int          fMaxIdleTime;
+
+    }; // class end
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
@@ -7,6 +7,7 @@
 #include "nuevdb/IFDatabase/DBIService.h"
 
 // Framework includes
+#include "art/Framework/Principal/Run.h"
 #include "messagefacility/MessageLogger/MessageLogger.h"
 
 namespace nutools
@@ -15,9 +16,13 @@ namespace dbi
 {
 
   //------------------------------------------------------------
-  DBIService::DBIService(const fhicl::ParameterSet& pset) : evdb::Reconfigurable{pset}
+  DBIService::DBIService(const fhicl::ParameterSet& pset,
+                         art::ActivityRegistry& reg) : evdb::Reconfigurable{pset}
   {
     reconfigure(pset);
+
+    reg.sPostEndRun.watch(this, &DBIService::postEndRun);
+    reg.sPostEndJob.watch(this, &DBIService::postEndJob);
   }
 
   //-----------------------------------------------------------
@@ -30,6 +35,21 @@ namespace dbi
     fWebServiceURL = pset.get< std::string >("WebServiceURL");
     fQueryEngineURL = pset.get< std::string >("QueryEngineURL");
     fDBUser = pset.get< std::string >("DBUser");
+    fWebServiceCacheDir = pset.get< std::string >("WebServiceCacheDir", "");
+    fWebServiceCacheTTL = pset.get< int >("WebServiceCacheTTL", 600);
+    fShareTables = pset.get< bool >("ShareTables", true);
+    fTableRegistry.SetMemoryBudget(pset.get< size_t >("TableMemoryBudget", 0) << 20);
+
+    int poolSize = pset.get< int >("ConnectionPoolSize", 8);
+    int poolIdleTime = pset.get< int >("ConnectionPoolIdleTime", 300);
+    if (poolSize <= 0)
+      fConnectionPool.reset();
+    else if (!fConnectionPool)
+      fConnectionPool = std::make_shared<ConnectionPool>(poolSize,poolIdleTime);
+    else {
+      fConnectionPool->SetMaxSize(poolSize);
+      fConnectionPool->SetMaxIdleTime(poolIdleTime);
+    }
   }
 
   //-----------------------------------------------------------
@@ -58,9 +78,48 @@ namespace dbi
     if (!fDBUser.empty())
       t->SetUser(fDBUser);
 
+    if (!fWebServiceCacheDir.empty())
+      t->SetWSCacheDir(fWebServiceCacheDir);
+    t->SetWSCacheTTL(fWebServiceCacheTTL);
+
+    if (fConnectionPool)
+      t->SetConnectionPool(fConnectionPool);
+
     return t;
   }
 
+  //-----------------------------------------------------------
+  std::shared_ptr<const FrozenTable> DBIService::LoadTable(std::unique_ptr<Table> t)
+  {
+    if (!t) return std::shared_ptr<const FrozenTable>();
+
+    if (fShareTables)
+      return fTableRegistry.Load(std::move(t));
+
+    if (!t->Load()) return std::shared_ptr<const FrozenTable>();
+    return Table::Freeze(std::move(t));
+  }
+
+  //-----------------------------------------------------------
+  void DBIService::postEndRun(const art::Run&)
+  {
+    // tables still held by modules live on until they let go
+    if (fTableRegistry.MemoryBudget() > 0)
+      fTableRegistry.Trim();
+    else
+      fTableRegistry.Release();
+  }
+
+  //-----------------------------------------------------------
+  void DBIService::postEndJob()
+  {
+    if (!fShareTables) return;
+    mf::LogInfo("DBIService") << "Shared tables: "
+                              << fTableRegistry.NHit() << " requests shared a loaded table, "
+                              << fTableRegistry.NMiss() << " were loaded, "
+                              << fTableRegistry.NEvicted() << " tables evicted";
+  }
+
 }
 }
 ////////////////////////////////////////////////////////////////////////
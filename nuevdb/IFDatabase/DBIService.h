@@ -7,13 +7,17 @@
 #define IFDBISERVICE_H
 
 #include <string>
+#include <memory>
 
+#include "art/Framework/Principal/fwd.h"
 #include "art/Framework/Services/Registry/ActivityRegistry.h"
 #include "art/Framework/Services/Registry/ServiceHandle.h"
 #include "art/Framework/Services/Registry/ServiceDeclarationMacros.h"
 #include "fhiclcpp/ParameterSet.h"
 #include "nuevdb/EventDisplayBase/Reconfigurable.h"
+#include "nuevdb/IFDatabase/ConnectionPool.h"
 #include "nuevdb/IFDatabase/Table.h"
+#include "nuevdb/IFDatabase/TableRegistry.h"
 
 
 namespace nutools
@@ -26,7 +30,7 @@ namespace nutools
     {
     public:
       // Get a RunHistoryService instance here
-      DBIService(const fhicl::ParameterSet& pset);
+      DBIService(const fhicl::ParameterSet& pset, art::ActivityRegistry& reg);
 
       void reconfigure(const fhicl::ParameterSet& pset);
 
@@ -35,7 +39,18 @@ namespace nutools
                          int tableType=nutools::dbi::kConditionsTable,
                          int dataSource=nutools::dbi::kOffline);
 
+      /// Load a table made by CreateTable() and set up, or, if another
+      /// module already asked for the very same contents, throw it away
+      /// and share theirs.  The tables are kept until the end of the run,
+      /// or with a TableMemoryBudget for as long as they fit in it, and
+      /// loaded again when asked for after that.  Null if the table
+      /// cannot be loaded.
+      std::shared_ptr<const FrozenTable> LoadTable(std::unique_ptr<Table> t);
+
     protected:
+      void postEndRun(const art::Run& run);
+      void postEndJob();
+
       int fVerbosity;
       bool fTimeQueries;
       bool fTimeParsing;
@@ -43,6 +58,14 @@ namespace nutools
       std::string fWebServiceURL;
       std::string fQueryEngineURL;
       std::string fDBUser;
+      std::string fWebServiceCacheDir;
+      int fWebServiceCacheTTL;
+      bool fShareTables;
+
+      TableRegistry fTableRegistry;
+
+      /// Shared by all the tables we create; null if pooling is disabled
+      std::shared_ptr<ConnectionPool> fConnectionPool;
 
     };
 
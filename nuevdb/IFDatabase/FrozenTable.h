@@ -0,0 +1,95 @@
+#ifndef __DBIFROZENTABLE_HPP_
+#define __DBIFROZENTABLE_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nuevdb/IFDatabase/Table.h"
+
+namespace nutools {
+  namespace dbi {
+
+    /**
+     * A loaded Table that can no longer change, made by Table::Freeze().
+     *
+     * It owns the table, which is fully indexed when frozen and has no
+     * database connection or look-up cursors, and offers only const
+     * reads.  Those write nothing: the comparison keys that Column
+     * otherwise caches at the first comparison are all filled in by
+     * Freeze().  So any number of threads may read one, and compare
+     * its columns, at the same time without locks.  Share it through
+     * the shared_ptr that Freeze() returns; the table goes with the
+     * last one.
+     */
+    class FrozenTable
+    {
+    public:
+      FrozenTable(const FrozenTable&) = delete;
+      FrozenTable& operator=(const FrozenTable&) = delete;
+
+      /// Everything else that can be read from the table
+      const Table& GetTable() const { return *fTable; }
+
+      std::string Name() const { return fTable->Name(); }
+      std::string Schema() const { return fTable->Schema(); }
+      std::string GetTag() const { return fTable->GetTag(); }
+      int  TableType() const { return fTable->TableType(); }
+      int  DataSource() const { return fTable->DataSource(); }
+      int  DataTypeMask() const { return fTable->DataTypeMask(); }
+      double GetMinTSVld() const { return fTable->GetMinTSVld(); }
+      double GetMaxTSVld() const { return fTable->GetMaxTSVld(); }
+
+      int  NCol() const { return fTable->NCol(); }
+      int  NRow() const { return fTable->NRow(); }
+      std::string GetColName(int i) const { return fTable->GetColName(i); }
+      int  GetColIndex(std::string cname) const
+      { return fTable->GetColIndex(cname); }
+      const Row* GetRow(int i) const { return fTable->GetRow(i); }
+
+      template <class T>
+        bool GetValue(int irow, int icol, T& val) const
+        { return fTable->GetValue(irow,icol,val); }
+
+      int  NVldChannels() const { return fTable->NVldChannels(); }
+      std::vector<uint64_t> VldChannels() const
+      { return fTable->VldChannels(); }
+      int  NVldRows(uint64_t channel) const
+      { return fTable->NVldRows(channel); }
+
+      /// See the Table methods of the same names
+      const Row* GetVldRow(uint64_t channel, double t) const
+      { return fTable->GetVldRow(channel,t); }
+      Span<const Row*> GetVldRows(uint64_t channel) const
+      { return fTable->GetVldRows(channel); }
+      void GetVldRows(uint64_t channel, double t0, double t1,
+                      std::vector<const Row*>& rows) const
+      { fTable->GetVldRows(channel,t0,t1,rows); }
+      void GetVldRowsCovering(uint64_t channel, double t0, double t1,
+                              std::vector<const Row*>& rows) const
+      { fTable->GetVldRowsCovering(channel,t0,t1,rows); }
+      void GetVldRowBatch(Span<uint64_t> channel, Span<double> t,
+                          std::vector<const Row*>& rows,
+                          bool parallel=false) const
+      { fTable->GetVldRowBatch(channel,t,rows,parallel); }
+      template <class T>
+        void GetVldValueBatch(Span<uint64_t> channel, Span<double> t,
+                              int icol, std::vector<T>& val,
+                              const T& missing=T(), bool parallel=false) const
+        { fTable->GetVldValueBatch(channel,t,icol,val,missing,parallel); }
+
+      size_t MemoryUsage() const { return fTable->MemoryUsage(); }
+
+    private:
+      friend class Table;
+
+      explicit FrozenTable(std::unique_ptr<Table> t) : fTable(std::move(t)) {}
+
+      std::unique_ptr<const Table> fTable;
+
+    }; // class end
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
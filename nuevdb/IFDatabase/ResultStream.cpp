@@ -0,0 +1,182 @@
+#include <iostream>
+
+#include <libpq-fe.h>
+
+#include <nuevdb/IFDatabase/ResultStream.h>
+#include <nuevdb/IFDatabase/Table.h>
+
+//************************************************************
+namespace nutools {
+  namespace dbi {
+
+    int ResultRow::NField() const
+    {
+      return PQnfields(fRes);
+    }
+
+    //************************************************************
+    std::string ResultRow::FieldName(int i) const
+    {
+      const char* n = PQfname(fRes,i);
+      return (n ? std::string(n) : std::string(""));
+    }
+
+    //************************************************************
+    int ResultRow::FieldIndex(const char* name) const
+    {
+      return PQfnumber(fRes,name);
+    }
+
+    //************************************************************
+    bool ResultRow::IsNull(int i) const
+    {
+      return PQgetisnull(fRes,0,i);
+    }
+
+    //************************************************************
+    const char* ResultRow::Value(int i) const
+    {
+      return PQgetvalue(fRes,0,i);
+    }
+
+    //************************************************************
+    int ResultRow::Length(int i) const
+    {
+      return PQgetlength(fRes,0,i);
+    }
+
+    //************************************************************
+    ResultStream::ResultStream(Table* t, const std::string& cmd) :
+      fTable(t), fCmd(cmd), fRes(0), fHasConn(true), fIsOk(false),
+      fIsDone(true), fStarted(false), fNRow(0)
+    {
+      if (t->fIgnoreDB || cmd == "") return;
+
+      fHasConn = t->fHasConnection;
+      if (! t->fHasConnection) {
+        t->GetConnection();
+        fHasConn = false;
+      }
+
+      if (!t->fConnection) {
+        std::cerr << "Table::StreamSQL: No connection to the database!" << std::endl;
+        return;
+      }
+
+      if (t->fVerbosity)
+        std::cerr << "Streaming SQL query: " << cmd << std::endl;
+
+      fT0 = std::chrono::steady_clock::now();
+
+      if (!PQsendQuery(t->fConnection,cmd.c_str()) ||
+          !PQsetSingleRowMode(t->fConnection)) {
+        std::cerr << "Table::StreamSQL: query failed: "
+                  << PQerrorMessage(t->fConnection) << std::endl;
+        Finish();
+        return;
+      }
+
+      fIsOk = true;
+      fIsDone = false;
+    }
+
+    //************************************************************
+    ResultStream::ResultStream(ResultStream&& s) noexcept :
+      fTable(s.fTable), fCmd(std::move(s.fCmd)), fRes(s.fRes),
+      fRow(s.fRow), fHasConn(s.fHasConn), fIsOk(s.fIsOk),
+      fIsDone(s.fIsDone), fStarted(s.fStarted), fNRow(s.fNRow),
+      fT0(s.fT0)
+    {
+      s.fRes = 0;
+      s.fRow.fRes = 0;
+      s.fIsDone = true;
+      s.fHasConn = true;
+    }
+
+    //************************************************************
+    ResultStream::~ResultStream()
+    {
+      if (!fIsDone) {
+        // stop the server sending us the rest of the rows
+        PGcancel* c = PQgetCancel(fTable->fConnection);
+        if (c) {
+          char errbuf[256];
+          PQcancel(c,errbuf,sizeof(errbuf));
+          PQfreeCancel(c);
+        }
+      }
+      Finish();
+    }
+
+    //************************************************************
+    ResultStream::iterator ResultStream::begin()
+    {
+      if (!fStarted) {
+        fStarted = true;
+        if (!fIsDone && Next()) return iterator(this);
+      }
+      return iterator();
+    }
+
+    //************************************************************
+    // Move on to the next row; false at the end of the results.
+    //************************************************************
+    bool ResultStream::Next()
+    {
+      if (fRes) PQclear(fRes);
+      fRes = 0;
+      fRow.fRes = 0;
+
+      if (fIsDone) return false;
+
+      fRes = PQgetResult(fTable->fConnection);
+      if (fRes && PQresultStatus(fRes) == PGRES_SINGLE_TUPLE) {
+        fRow.fRes = fRes;
+        ++fNRow;
+        return true;
+      }
+
+      // PGRES_TUPLES_OK (no more rows) or an error
+      if (!fRes || (PQresultStatus(fRes) != PGRES_TUPLES_OK &&
+                    PQresultStatus(fRes) != PGRES_COMMAND_OK)) {
+        std::cerr << "Table::StreamSQL: query failed after " << fNRow
+                  << " rows: " << PQerrorMessage(fTable->fConnection)
+                  << std::endl;
+        fIsOk = false;
+      }
+      Finish();
+      return false;
+    }
+
+    //************************************************************
+    void ResultStream::Finish()
+    {
+      if (fRes) PQclear(fRes);
+      fRes = 0;
+      fRow.fRes = 0;
+
+      if (!fIsDone) {
+        // the connection is only usable again once all results are read
+        PGresult* res;
+        while ((res = PQgetResult(fTable->fConnection)) != 0)
+          PQclear(res);
+        fIsDone = true;
+
+        if (fTable->fTimeQueries) {
+          std::chrono::milliseconds tdiff =
+            std::chrono::duration_cast<std::chrono::milliseconds>
+            (std::chrono::steady_clock::now() - fT0);
+          std::cerr << "Table::StreamSQL(" << fCmd << "): query took "
+                    << tdiff.count() << " ms for " << fNRow << " rows"
+                    << std::endl;
+        }
+      }
+
+      if (!fHasConn) {
+        fTable->CloseConnection();
+        fHasConn = true;
+      }
+    }
+
+  }
+}
@@ -0,0 +1,133 @@
+#ifndef __DBIRESULTSTREAM_HPP_
+#define __DBIRESULTSTREAM_HPP_
+
+#include <string>
+#include <cstring>
+#include <iterator>
+#include <chrono>
+#include <type_traits>
+
+#include "nuevdb/IFDatabase/ColumnStore.h"
+
+// Forward declarations for postgres types
+struct pg_result;
+typedef pg_result PGresult;
+
+namespace nutools {
+  namespace dbi {
+
+    class Table;
+
+    /**
+     * View of the current row of a ResultStream; only valid until the
+     * stream moves on to the next row.
+     */
+    class ResultRow
+    {
+    public:
+      ResultRow() : fRes(0) {}
+
+      int         NField() const;
+      std::string FieldName(int i) const;
+      int         FieldIndex(const char* name) const; ///< -1 if not found
+      bool        IsNull(int i) const;
+      const char* Value(int i) const;  ///< "" if NULL
+      int         Length(int i) const;
+
+      /// Numbers and bools are parsed in place; false if NULL or bad
+      template <class T>
+        bool Get(int i, T& val) const {
+        if (i < 0 || i >= NField() || IsNull(i)) return false;
+        if constexpr (std::is_same<T,bool>::value)
+          return ColumnStore::ParseBool(Value(i),Length(i),val);
+        else if constexpr (ColumnStore::kIsNumber<T>)
+          return ColumnStore::ParseNumber(Value(i),Length(i),val);
+        else {
+          val = T(Value(i));
+          return true;
+        }
+      }
+
+    private:
+      friend class ResultStream;
+      const PGresult* fRes;
+    };
+
+    /**
+     * Results of an SQL query, read one row at a time with libpq's
+     * single-row mode rather than all at once as Table::ExecuteSQL()
+     * does, so that memory use does not grow with the size of the
+     * result.  Made by Table::StreamSQL(); use as
+     *
+     *   for (const ResultRow& r : table.StreamSQL("SELECT ..."))
+     *     ...
+     *
+     * The stream can only be iterated once.  When it ends (or is
+     * destroyed, which cancels the query) the table's connection is
+     * closed, or returned to its pool, unless the table already had one
+     * open.  The table must outlive the stream.
+     */
+    class ResultStream
+    {
+    public:
+      class iterator {
+      public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef ResultRow               value_type;
+        typedef std::ptrdiff_t          difference_type;
+        typedef const ResultRow*        pointer;
+        typedef const ResultRow&        reference;
+
+        iterator(ResultStream* s=0) : fStream(s) {}
+
+        reference operator*() const { return fStream->fRow; }
+        pointer   operator->() const { return &fStream->fRow; }
+        iterator& operator++() {
+          if (!fStream->Next()) fStream = 0;
+          return *this;
+        }
+        bool operator==(const iterator& it) const
+        { return fStream == it.fStream; }
+        bool operator!=(const iterator& it) const
+        { return fStream != it.fStream; }
+
+      private:
+        ResultStream* fStream;
+      };
+
+      ResultStream(Table* t, const std::string& cmd);
+      ResultStream(ResultStream&& s) noexcept;
+      ~ResultStream();
+
+      ResultStream(const ResultStream&) = delete;
+      ResultStream& operator=(const ResultStream&) = delete;
+      ResultStream& operator=(ResultStream&&) = delete;
+
+      iterator begin();
+      iterator end() { return iterator(); }
+
+      /// false if the query failed, now or part way through
+      bool IsOk() const { return fIsOk; }
+      long NRow() const { return fNRow; }  ///< rows read so far
+
+    private:
+      bool Next();
+      void Finish();
+
+      Table*    fTable;
+      std::string fCmd;
+      PGresult* fRes;
+      ResultRow fRow;
+      bool      fHasConn;
+      bool      fIsOk;
+      bool      fIsDone;
+      bool      fStarted;
+      long      fNRow;
+      std::chrono::steady_clock::time_point fT0;
+
+    }; // class end
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
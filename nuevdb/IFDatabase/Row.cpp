@@ -21,7 +21,7 @@ namespace nutools {
     
     //************************************************************
     
-    Row::Row(std::vector<ColumnDef>& col) : 
+    Row::Row(const std::vector<ColumnDef>& col) : 
       fInDB(false), fIsVldRow(false), fNModified(0),
       fChannel(0xffffffff),fVldTime(0),fVldTimeEnd(0) 
     {
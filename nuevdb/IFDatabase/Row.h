@@ -22,8 +22,13 @@ namespace nutools {
       Row(int ncol) : fIsVldRow(false), fNModified(0), fCol(ncol) { };
       
       Row(const std::vector<Column>&);
-      Row(std::vector<ColumnDef>&);
+      Row(const std::vector<ColumnDef>&);
+      Row(const Row&) = default;
+      Row(Row&&) = default;
       ~Row();
+
+      Row& operator=(const Row&) = default;
+      Row& operator=(Row&&) = default;
       
       void    Clear();
       
@@ -43,23 +48,30 @@ namespace nutools {
 	return false;
       }
 
-      bool    InDB() { return fInDB; }
+      bool    InDB() const { return fInDB; }
       void    SetInDB() { fInDB = true; }
 
-      int     NModified() { return fNModified; }
+      int     NModified() const { return fNModified; }
 
-      int     NCol() { return fCol.size(); }
+      int     NCol() const { return fCol.size(); }
+      /// Bytes of heap held by the columns and their values
+      size_t  HeapSize() const {
+	size_t n = fCol.capacity()*sizeof(Column);
+	for (unsigned int i=0; i<fCol.size(); ++i) n += fCol[i].HeapSize();
+	return n;
+      }
 
       Column& Col(int i) {return fCol[i]; }
+      const Column& Col(int i) const {return fCol[i]; }
 
-      uint64_t Channel() { return fChannel; }
-      double    VldTime() { return fVldTime; } 
-      double    VldTimeEnd() { return fVldTimeEnd; }
-      bool     IsVldRow() { return fIsVldRow; }
+      uint64_t Channel() const { return fChannel; }
+      double    VldTime() const { return fVldTime; } 
+      double    VldTimeEnd() const { return fVldTimeEnd; }
+      bool     IsVldRow() const { return fIsVldRow; }
 
       bool    SetChannel(uint64_t ch) { fIsVldRow=true; return (fChannel=ch); }
       bool    SetVldTime(double t) { fIsVldRow=true; return (fVldTime=t); }
-      bool    SetVldTimeEnd(double t) { fIsVldRow=true; return (fVldTime=t); }
+      bool    SetVldTimeEnd(double t) { fIsVldRow=true; return (fVldTimeEnd=t); }
       
       //      bool operator==(const Row& other) const;
 
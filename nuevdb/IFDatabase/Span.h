@@ -0,0 +1,51 @@
+#ifndef __DBISPAN_HPP_
+#define __DBISPAN_HPP_
+
+#include <cstddef>
+#include <vector>
+
+namespace nutools {
+  namespace dbi {
+
+    /**
+     * Non-owning view of a run of contiguous elements, such as the
+     * validity rows of one channel (Table::GetVldRows()).  It is only
+     * valid until whatever it points into changes.  Converts to a
+     * std::vector for code that wants its own copy, and from one for
+     * functions that take a Span.
+     */
+    template <class T>
+      class Span
+      {
+      public:
+        typedef T        value_type;
+        typedef const T* iterator;
+        typedef const T* const_iterator;
+
+        Span() : fData(0), fSize(0) {}
+        Span(const T* data, size_t n) : fData(data), fSize(n) {}
+        Span(const std::vector<T>& v) : fData(v.data()), fSize(v.size()) {}
+
+        const T* begin() const { return fData; }
+        const T* end() const { return fData + fSize; }
+        const T* data() const { return fData; }
+
+        size_t size() const { return fSize; }
+        bool   empty() const { return (fSize == 0); }
+
+        const T& operator[](size_t i) const { return fData[i]; }
+        const T& front() const { return fData[0]; }
+        const T& back() const { return fData[fSize-1]; }
+
+        operator std::vector<T>() const { return std::vector<T>(begin(),end()); }
+
+      private:
+        const T* fData;
+        size_t   fSize;
+
+      }; // class end
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
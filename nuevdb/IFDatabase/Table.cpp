@@ -3,13 +3,22 @@
 #include <fstream>
 #include <sstream>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <cctype>
 #include <algorithm>
 #include <ctime>
 #include <cinttypes>
 #include <cstdio>
+#include <cstring>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <atomic>
 
 #include <libpq-fe.h>
+#include <libpq-events.h>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
@@ -17,7 +26,13 @@
 
 #include "wda.h"
 
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+
 #include <nuevdb/IFDatabase/Table.h>
+#include <nuevdb/IFDatabase/AsyncLoader.h>
+#include <nuevdb/IFDatabase/FrozenTable.h>
 #include <nuevdb/IFDatabase/Util.h>
 
 namespace {
@@ -26,6 +41,633 @@ namespace {
     ~LibwdaSentry() { wda_global_cleanup(); }
   };
   LibwdaSentry sentry;
+
+  //************************************************************
+  // Decoding of the postgres binary wire format (network byte order).
+  // Only the types we actually use in conditions tables are handled;
+  // anything else makes LoadFromDB() fall back to text format.
+  //************************************************************
+  const Oid kBoolOID = 16;
+  const Oid kNameOID = 19;
+  const Oid kInt8OID = 20;
+  const Oid kInt2OID = 21;
+  const Oid kInt4OID = 23;
+  const Oid kTextOID = 25;
+  const Oid kFloat4OID = 700;
+  const Oid kFloat8OID = 701;
+  const Oid kBpcharOID = 1042;
+  const Oid kVarcharOID = 1043;
+  const Oid kDateOID = 1082;
+  const Oid kTimestampOID = 1114;
+
+  // postgres counts dates and times from 2000-01-01
+  const int64_t kPGEpochDays = 10957;
+  const int64_t kPGEpochUSec = kPGEpochDays*86400000000LL;
+
+  bool IsBinaryDecodable(Oid oid)
+  {
+    switch (oid) {
+    case kBoolOID:   case kNameOID:   case kInt8OID:    case kInt2OID:
+    case kInt4OID:   case kTextOID:   case kFloat4OID:  case kFloat8OID:
+    case kBpcharOID: case kVarcharOID: case kDateOID:   case kTimestampOID:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  uint64_t ReadUInt(const char* v, int len)
+  {
+    uint64_t u = 0;
+    for (int i=0; i<len; ++i) u = (u << 8) | (unsigned char)v[i];
+    return u;
+  }
+
+  int64_t ReadInt(const char* v, int len)
+  {
+    uint64_t u = ReadUInt(v,len);
+    if (len < 8 && (u >> (8*len-1))) u |= ~uint64_t(0) << (8*len);
+    return int64_t(u);
+  }
+
+  double ReadFloat8(const char* v)
+  {
+    uint64_t u = ReadUInt(v,8);
+    double d;
+    memcpy(&d,&u,sizeof(d));
+    return d;
+  }
+
+  float ReadFloat4(const char* v)
+  {
+    uint32_t u = ReadUInt(v,4);
+    float f;
+    memcpy(&f,&u,sizeof(f));
+    return f;
+  }
+
+  // Print a float the way postgres (>= 12) does: shortest round-trip
+  // digits, with an exponent only outside [1e-4, 1e(ndig))
+  template <class T>
+    size_t FormatFloat(T v, int ndig, char* buf, size_t n)
+    {
+      if (std::isnan(v)) { memcpy(buf,"NaN",3); return 3; }
+      if (std::isinf(v)) {
+        if (v > 0) { memcpy(buf,"Infinity",8); return 8; }
+        memcpy(buf,"-Infinity",9); return 9;
+      }
+      T a = std::fabs(v);
+      bool isFixed = (a == 0 || (a >= T(1e-4) && a < std::pow(T(10),ndig)));
+      std::to_chars_result r =
+        std::to_chars(buf,buf+n,v,(isFixed ? std::chars_format::fixed :
+                                   std::chars_format::scientific));
+      return r.ptr - buf;
+    }
+
+  // Convert a binary value back to the text postgres would have sent.
+  // v is replaced by buf unless the value is already text.
+  int BinaryToText(Oid oid, const char*& v, int len, char* buf, size_t n)
+  {
+    switch (oid) {
+    case kBoolOID:
+      buf[0] = (v[0] ? 't' : 'f');
+      v = buf;
+      return 1;
+    case kInt2OID:
+    case kInt4OID:
+    case kInt8OID: {
+      std::to_chars_result r = std::to_chars(buf,buf+n,ReadInt(v,len));
+      v = buf;
+      return r.ptr - buf;
+    }
+    case kFloat4OID:
+      len = FormatFloat(ReadFloat4(v),6,buf,n);
+      v = buf;
+      return len;
+    case kFloat8OID:
+      len = FormatFloat(ReadFloat8(v),15,buf,n);
+      v = buf;
+      return len;
+    case kDateOID: {
+      int64_t d = ReadInt(v,4);
+      v = buf;
+      if (d == INT32_MAX) { strcpy(buf,"infinity"); return 8; }
+      if (d == INT32_MIN) { strcpy(buf,"-infinity"); return 9; }
+      return nutools::dbi::ColumnStore::FormatDate(d+kPGEpochDays,buf);
+    }
+    case kTimestampOID: {
+      int64_t t = ReadInt(v,8);
+      v = buf;
+      if (t == INT64_MAX) { strcpy(buf,"infinity"); return 8; }
+      if (t == INT64_MIN) { strcpy(buf,"-infinity"); return 9; }
+      return nutools::dbi::ColumnStore::FormatTime(t+kPGEpochUSec,buf);
+    }
+    default:  // text types are sent as-is
+      return len;
+    }
+  }
+
+  // Store a binary value into typed column storage.  Values only skip
+  // the text conversion if they already have the stored type, so that
+  // e.g. a float4 in a double column is rounded exactly as it would be
+  // in text mode.
+  void SetFromBinary(nutools::dbi::ColumnStore& store, unsigned int irow,
+                     unsigned int icol, Oid oid, const char* v, int len)
+  {
+    typedef nutools::dbi::ColumnStore CS;
+    const int type = store.Type(icol);
+
+    switch (oid) {
+    case kBoolOID:
+      if (type == CS::kStoreBool) { store.SetBool(irow,icol,v[0]); return; }
+      break;
+    case kInt2OID:
+    case kInt4OID:
+    case kInt8OID:
+      if (type == CS::kStoreInt) {
+        store.SetInt(irow,icol,ReadInt(v,len));
+        return;
+      }
+      break;
+    case kFloat4OID:
+      if (type == CS::kStoreFloat) {
+        store.SetDouble(irow,icol,ReadFloat4(v));
+        return;
+      }
+      break;
+    case kFloat8OID:
+      if (type == CS::kStoreDouble) {
+        store.SetDouble(irow,icol,ReadFloat8(v));
+        return;
+      }
+      break;
+    case kDateOID: {
+      int64_t d = ReadInt(v,4);
+      if (type == CS::kStoreDate && d != INT32_MAX && d != INT32_MIN) {
+        store.SetDate(irow,icol,d+kPGEpochDays);
+        return;
+      }
+      break;
+    }
+    case kTimestampOID: {
+      int64_t t = ReadInt(v,8);
+      if (type == CS::kStoreTime && t != INT64_MAX && t != INT64_MIN) {
+        store.SetTime(irow,icol,t+kPGEpochUSec);
+        return;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+
+    char buf[64];
+    len = BinaryToText(oid,v,len,buf,sizeof(buf));
+    store.SetFromString(irow,icol,v,len);
+  }
+
+  //************************************************************
+  // Append a value to a COPY ... FROM STDIN text-format buffer
+  //************************************************************
+  void AppendCopyValue(std::string& buf, const std::string& v)
+  {
+    for (size_t i=0; i<v.length(); ++i) {
+      switch (v[i]) {
+      case '\\': buf += "\\\\"; break;
+      case '\t': buf += "\\t"; break;
+      case '\n': buf += "\\n"; break;
+      case '\r': buf += "\\r"; break;
+      default:   buf += v[i];
+      }
+    }
+  }
+
+  //************************************************************
+  // Prepared statements are per connection, so the list of those
+  // already prepared is attached to the PGconn as libpq event instance
+  // data and freed by libpq when the connection is closed.
+  //************************************************************
+  typedef std::map<std::string,std::string> StatementMap;
+
+  int PreparedStatementsProc(PGEventId evtId, void* evtInfo, void*)
+  {
+    if (evtId == PGEVT_CONNRESET) {
+      PGEventConnReset* e = (PGEventConnReset*)evtInfo;
+      StatementMap* stmts =
+        (StatementMap*)PQinstanceData(e->conn,PreparedStatementsProc);
+      if (stmts) stmts->clear();
+    }
+    else if (evtId == PGEVT_CONNDESTROY) {
+      PGEventConnDestroy* e = (PGEventConnDestroy*)evtInfo;
+      delete (StatementMap*)PQinstanceData(e->conn,PreparedStatementsProc);
+    }
+    return 1;
+  }
+
+  StatementMap* PreparedStatements(PGconn* conn)
+  {
+    if (!conn) return 0;
+    StatementMap* stmts =
+      (StatementMap*)PQinstanceData(conn,PreparedStatementsProc);
+    if (!stmts) {
+      if (!PQregisterEventProc(conn,PreparedStatementsProc,
+                               "nutools::dbi prepared statements",NULL))
+        return 0;
+      stmts = new StatementMap;
+      PQsetInstanceData(conn,PreparedStatementsProc,stmts);
+    }
+    return stmts;
+  }
+
+  // for unique cursor names
+  std::atomic<unsigned int> gCursorCount(0);
+
+  // FNV-1a, used to name prepared statements after their SQL
+  uint64_t HashSQL(const std::string& sql)
+  {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i=0; i<sql.length(); ++i) {
+      h ^= (unsigned char)sql[i];
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  // for unique temporary file names within this process
+  std::atomic<unsigned int> gTempCount(0);
+
+  // A name to write fname under before renaming it, that no other
+  // process, or thread of this one, uses at the same time
+  std::string TempName(const std::string& fname)
+  {
+    return (fname + "." + std::to_string(getpid()) + "." +
+            std::to_string(++gTempCount));
+  }
+
+  // Written to a temporary file first and renamed, so that the many
+  // jobs that may be doing this at once never see half a file.
+  void WriteAtomically(const std::string& fname, const std::string& data)
+  {
+    std::string tmpName = TempName(fname);
+    std::ofstream fout(tmpName.c_str(),std::ios::binary);
+    if (!fout.is_open()) return;
+
+    fout.write(data.data(),data.size());
+    fout.close();
+
+    if (fout.fail() || rename(tmpName.c_str(),fname.c_str()) != 0)
+      unlink(tmpName.c_str());
+  }
+
+  const char* const kWSCacheMagic = "# nutools::dbi web service cache 1";
+
+  void AppendUInt32(std::string& buf, uint32_t n)
+  {
+    buf.append((const char*)&n,sizeof(n));
+  }
+
+  // The tuples of a web service response, read either from libwda or
+  // from the copy of an earlier response kept in the local cache.  The
+  // cached copy is the header line and key, then the number of tuples,
+  // and then for each tuple its number of fields followed by each
+  // field's length and value.
+  class WSTuples
+  {
+  public:
+    explicit WSTuples(Dataset ds) :
+      fDS(ds), fTu(NULL), fCached(NULL), fCountPos(0), fPos(0), fNField(0),
+      fRecord(NULL)
+    {}
+
+    // cached must hold a whole, checked, cache file, with fPos just
+    // past the key
+    WSTuples(const std::string* cached, size_t pos) :
+      fDS(NULL), fTu(NULL), fCached(cached), fCountPos(pos), fPos(pos),
+      fNField(0), fRecord(NULL)
+    {}
+
+    ~WSTuples() { if (fTu) releaseTuple(fTu); }
+
+    // everything read from libwda from now on is also appended to rec
+    void Record(std::string* rec)
+    {
+      fRecord = rec;
+      if (fRecord) AppendUInt32(*fRecord,NTuples());
+    }
+
+    int NTuples()
+    {
+      if (!fCached) return getNtuples(fDS);
+      uint32_t n = 0;
+      if (fCached->size() >= fCountPos + sizeof(n))
+        memcpy(&n,fCached->data()+fCountPos,sizeof(n));
+      return n;
+    }
+
+    // move on to the first or next tuple; false at the end
+    bool Next()
+    {
+      if (!fCached) {
+        if (fTu) {
+          releaseTuple(fTu);
+          fTu = getNextTuple(fDS);
+        }
+        else
+          fTu = getFirstTuple(fDS);
+        if (!fTu) return false;
+        fNField = getNfields(fTu);
+        if (fRecord) {
+          char buf[1024];
+          int err;
+          AppendUInt32(*fRecord,fNField);
+          for (int i=0; i<fNField; ++i) {
+            getStringValue(fTu,i,buf,sizeof(buf),&err);
+            uint32_t len = strlen(buf);
+            AppendUInt32(*fRecord,len);
+            fRecord->append(buf,len);
+          }
+        }
+        return true;
+      }
+
+      if (fPos == fCountPos) fPos += sizeof(uint32_t);
+
+      fField.clear();
+      uint32_t n;
+      if (fCached->size() < fPos + sizeof(n)) return false;
+      memcpy(&n,fCached->data()+fPos,sizeof(n));
+      fPos += sizeof(n);
+      for (uint32_t i=0; i<n; ++i) {
+        uint32_t len;
+        if (fCached->size() < fPos + sizeof(len)) return false;
+        memcpy(&len,fCached->data()+fPos,sizeof(len));
+        fPos += sizeof(len);
+        if (fCached->size() < fPos + len) return false;
+        fField.push_back(std::make_pair(fPos,len));
+        fPos += len;
+      }
+      fNField = n;
+      return true;
+    }
+
+    int NFields() const { return fNField; }
+
+    // copy field i into buf, truncated as getStringValue() does
+    void Get(int i, char* buf, int size)
+    {
+      if (!fCached) {
+        int err;
+        getStringValue(fTu,i,buf,size,&err);
+        return;
+      }
+      if (i >= fNField) {
+        buf[0] = '\0';
+        return;
+      }
+      size_t len = std::min<size_t>(fField[i].second,size-1);
+      memcpy(buf,fCached->data()+fField[i].first,len);
+      buf[len] = '\0';
+    }
+
+  private:
+    Dataset fDS;
+    Tuple   fTu;
+    const std::string* fCached;
+    size_t  fCountPos;
+    size_t  fPos;
+    int     fNField;
+    std::string* fRecord;
+    std::vector<std::pair<size_t,uint32_t> > fField; ///< offset, length
+  };
+
+  // True if the tuples from pos on are exactly as many as their count
+  // says, each one whole, with nothing after the last
+  bool IsWholeWSCache(const std::string& buf, size_t pos)
+  {
+    uint32_t ntup;
+    if (buf.size() < pos + sizeof(ntup)) return false;
+    memcpy(&ntup,buf.data()+pos,sizeof(ntup));
+    pos += sizeof(ntup);
+
+    for (uint32_t itup=0; itup<ntup; ++itup) {
+      uint32_t n;
+      if (buf.size() - pos < sizeof(n)) return false;
+      memcpy(&n,buf.data()+pos,sizeof(n));
+      pos += sizeof(n);
+      for (uint32_t i=0; i<n; ++i) {
+        uint32_t len;
+        if (buf.size() - pos < sizeof(len)) return false;
+        memcpy(&len,buf.data()+pos,sizeof(len));
+        pos += sizeof(len);
+        if (buf.size() - pos < len) return false;
+        pos += len;
+      }
+    }
+    return (pos == buf.size());
+  }
+
+  // Read the cached response to the query key into buf, unless it is
+  // older than ttl seconds (ttl < 0 means it never is); returns where
+  // the tuples start, or 0 if there is no usable copy.  A copy that is
+  // cut short, or has anything after it, is no use either: it would
+  // load part of the table as if it were all of it.
+  size_t ReadWSCache(const std::string& fname, const std::string& key,
+                     int ttl, std::string& buf)
+  {
+    struct stat st;
+    if (stat(fname.c_str(),&st) != 0) return 0;
+    if (ttl >= 0 && time(NULL) - st.st_mtime > ttl) return 0;
+
+    std::ifstream fin(fname.c_str(),std::ios::binary);
+    if (!fin.is_open()) return 0;
+    buf.assign(std::istreambuf_iterator<char>(fin),
+               std::istreambuf_iterator<char>());
+
+    std::string head = std::string(kWSCacheMagic) + "\n" + key + "\n";
+    if (buf.compare(0,head.size(),head) != 0) return 0;
+    if (!IsWholeWSCache(buf,head.size())) return 0;
+    return head.size();
+  }
+
+  //************************************************************
+  // A table snapshot (Table::SaveSnapshot()) is this header, the table
+  // and column names, the offset and size of each ColumnStore section
+  // and of the five of the channel index, and then the sections
+  // themselves.  Every section starts on an 8-byte boundary so that it
+  // can be used in place once mapped.
+  //************************************************************
+  const char kSnapshotMagic[8] = {'D','B','I','S','N','A','P','\0'};
+  const uint32_t kSnapshotVersion = 2;
+  const uint32_t kSnapshotByteOrder = 0x01020304;
+
+  struct SnapshotHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byteOrder;  ///< reads differently on a foreign-endian host
+    uint64_t nrow;
+    uint64_t ncol;
+    int32_t  tableType;
+    int32_t  dataTypeMask;
+    double   minTSVld;
+    double   maxTSVld;
+    uint64_t metaSize;   ///< of the names that follow the header
+  };
+
+  uint64_t Align8(uint64_t n) { return (n + 7) & ~uint64_t(7); }
+
+  // Unmaps a snapshot once the last store using it lets go
+  struct SnapshotMapping {
+    SnapshotMapping(void* a, size_t n) : addr(a), len(n) {}
+    ~SnapshotMapping() { munmap(addr,len); }
+    void*  addr;
+    size_t len;
+  };
+
+  //************************************************************
+  // The end of the validity of r; rows without a tvend (or with one
+  // that is not after tv) stay valid
+  double VldTimeEnd(const nutools::dbi::Row& r)
+  {
+    if (r.VldTimeEnd() > r.VldTime()) return r.VldTimeEnd();
+    return std::numeric_limits<double>::infinity();
+  }
+
+  //************************************************************
+  // lower_bound and upper_bound for a value that is expected to be
+  // near b: the step doubles until it passes v, and only the last
+  // step is searched
+  //************************************************************
+  template <class T>
+    const T* GallopLower(const T* b, const T* e, const T& v)
+    {
+      size_t step = 1;
+      while (step < size_t(e-b) && b[step-1] < v) { b += step; step *= 2; }
+      return std::lower_bound(b,std::min(b+step,e),v);
+    }
+
+  template <class T>
+    const T* GallopUpper(const T* b, const T* e, const T& v)
+    {
+      size_t step = 1;
+      while (step < size_t(e-b) && !(v < b[step-1])) { b += step; step *= 2; }
+      return std::upper_bound(b,std::min(b+step,e),v);
+    }
+
+  //************************************************************
+  // Interval trees over the validity rows of a channel.  The rows are
+  // in order of validity time, so the intervals [tv,tvend) that start
+  // at or before some time are a prefix of them; a tree of the largest
+  // tvend under each node then finds the ones in such a prefix that
+  // end after some other time without looking at the rest.  A channel
+  // of n rows has a tree of 2n-1 nodes: node v covers rows [l,r], its
+  // children are v+1 for [l,m] and v+2(m-l+1) for [m+1,r].
+  //************************************************************
+  double BuildMaxEnd(double* tree, const double* end,
+                     unsigned int v, unsigned int l, unsigned int r)
+  {
+    if (l == r) return (tree[v] = end[l]);
+    unsigned int m = (l+r)/2;
+    double a = BuildMaxEnd(tree,end,v+1,l,m);
+    double b = BuildMaxEnd(tree,end,v+2*(m-l+1),m+1,r);
+    return (tree[v] = std::max(a,b));
+  }
+
+  // The last of rows [l,min(r,p)] that ends after t, or -1
+  int LastEndingAfter(const double* tree, unsigned int v,
+                      unsigned int l, unsigned int r, unsigned int p, double t)
+  {
+    if (l > p || !(tree[v] > t)) return -1;
+    if (l == r) return l;
+    unsigned int m = (l+r)/2;
+    int i = LastEndingAfter(tree,v+2*(m-l+1),m+1,r,p,t);
+    if (i >= 0) return i;
+    return LastEndingAfter(tree,v+1,l,m,p,t);
+  }
+
+  // Append all of rows [l,min(r,p)] that end after t, in order
+  void AllEndingAfter(const double* tree, unsigned int v,
+                      unsigned int l, unsigned int r, unsigned int p, double t,
+                      nutools::dbi::Row* const* row,
+                      std::vector<const nutools::dbi::Row*>& rows)
+  {
+    if (l > p || !(tree[v] > t)) return;
+    if (l == r) { rows.push_back(row[l]); return; }
+    unsigned int m = (l+r)/2;
+    AllEndingAfter(tree,v+1,l,m,p,t,row,rows);
+    AllEndingAfter(tree,v+2*(m-l+1),m+1,r,p,t,row,rows);
+  }
+
+  //************************************************************
+  // The channel index of nrow rows (see Table::FillChanRowMap()), with
+  // the rows in it given by number.  This is one sort of (channel,
+  // time, row) keys, rather than an insertion per row.  get(i,chan,tv,
+  // end) gives the validity of row i, with an infinite end if it has
+  // none.
+  //************************************************************
+  template <class F>
+    void MakeChanIndex(unsigned int nrow, F get,
+                       std::vector<uint64_t>& chanKey,
+                       std::vector<unsigned int>& chanOffset,
+                       std::vector<unsigned int>& chanRow,
+                       std::vector<double>& chanTime,
+                       std::vector<double>& chanMaxEnd)
+    {
+      struct VldKey {
+        uint64_t     chan;
+        double       tv;
+        unsigned int row;
+        bool operator<(const VldKey& k) const {
+          if (chan != k.chan) return (chan < k.chan);
+          if (tv != k.tv) return (tv < k.tv);
+          return (row < k.row);
+        }
+      };
+
+      std::vector<VldKey> key(nrow);
+      std::vector<double> rowEnd(nrow);
+      for (unsigned int i=0; i<nrow; ++i) {
+        get(i,key[i].chan,key[i].tv,rowEnd[i]);
+        key[i].row = i;
+      }
+      std::sort(key.begin(),key.end());
+
+      chanKey.clear();
+      chanOffset.clear();
+      chanRow.resize(nrow);
+      chanTime.resize(nrow);
+      chanMaxEnd.clear();
+      std::vector<double> end(nrow);
+      bool hasEnd = false;
+      for (unsigned int i=0; i<nrow; ++i) {
+        if (chanKey.empty() || key[i].chan != chanKey.back()) {
+          chanKey.push_back(key[i].chan);
+          chanOffset.push_back(i);
+        }
+        chanRow[i] = key[i].row;
+        chanTime[i] = key[i].tv;
+        end[i] = rowEnd[key[i].row];
+        if (end[i] != std::numeric_limits<double>::infinity()) hasEnd = true;
+      }
+      chanOffset.push_back(nrow);
+      chanKey.shrink_to_fit();
+      chanOffset.shrink_to_fit();
+
+      // without any end times, every row stays valid until the next
+      // one starts, and the trees would tell nothing
+      if (!hasEnd) return;
+      chanMaxEnd.resize(2*nrow - chanKey.size());
+      for (unsigned int k=0; k<chanKey.size(); ++k) {
+        unsigned int off = chanOffset[k];
+        unsigned int n = chanOffset[k+1] - off;
+        // a row without an end time ends where the next one starts; one
+        // superseded by a row that starts at the same time never is
+        for (unsigned int i=off; i+1<off+n; ++i)
+          if (end[i] == std::numeric_limits<double>::infinity())
+            end[i] = (chanTime[i+1] > chanTime[i] ? chanTime[i+1] :
+                      -std::numeric_limits<double>::infinity());
+        BuildMaxEnd(&chanMaxEnd[2*off-k],&end[off],0,0,n-1);
+      }
+    }
 }
 
 namespace nutools {
@@ -60,6 +702,15 @@ namespace nutools {
       fIgnoreDB = false;
       fTimeQueries = true;
       fTimeParsing = true;
+      fColumnarStorage = false;
+      fBinaryTransfer = false;
+      fBulkInsert = false;
+      fPrepareStatements = false;
+      fPoolBusy = false;
+      fFetchSize = 0;
+      fInsertBatchSize = 0;
+      fNRowViews = 0;
+      fVldCursor = false;
       fMinChannel = 0;
       fMaxChannel = 0;
       fFolder = "";
@@ -93,6 +744,14 @@ namespace nutools {
       const char* qeHost = getenv("DBIQEURL");
       if (qeHost) fQEURL = std::string(qeHost);
 
+      fWSCacheDir = "";
+      const char* wsCacheDir = getenv("DBIWSCACHEDIR");
+      if (wsCacheDir) fWSCacheDir = std::string(wsCacheDir);
+
+      fWSCacheTTL = 600;
+      tmpStr = getenv("DBIWSCACHETTL");
+      if (tmpStr) fWSCacheTTL = atoi(tmpStr);
+
       fVerbosity=0;
       tmpStr = getenv("DBIVERB");
       if (tmpStr) {
@@ -111,14 +770,29 @@ namespace nutools {
       fHasConnection=false;
       std::string errStr;
       fIgnoreDB = false;
+      fIgnoreEnvVar = false;
+      fTableType = ttype;
 
       fTimeQueries = true;
       fTimeParsing = true;
 
+      fColumnarStorage = false;
+      fBinaryTransfer = false;
+      fBulkInsert = false;
+      fPrepareStatements = false;
+      fPoolBusy = false;
+      fFetchSize = 0;
+      fInsertBatchSize = 0;
+      fNRowViews = 0;
+      fVldCursor = false;
+
       fMinChannel = 0;
       fMaxChannel = 0;
 
       fFolder = "";
+
+      fWSCacheDir = "";
+      fWSCacheTTL = 600;
       
       fDataSource = kUnknownSource;
 
@@ -165,55 +839,30 @@ namespace nutools {
       std::string stName = fSchema + std::string(".") + std::string(tableName);
       //      fIgnoreEnvVar = true;
 
-      if (!ExistsInDB()) {
-        errStr = "Table::Table(): table \'" + stName + "\' not found in database!";
-        throw std::runtime_error(errStr);
-      }
-      
       Reset();
       fCol.clear();
 
-      bool hasConn = fHasConnection;
-      if (! fHasConnection) {
-        GetConnection();
-        hasConn = false;
-      }
-
-      std::vector<std::string> pkeyList;
-      // get list of rows that are primary keys
-      std::string cmd = "SELECT pg_attribute.attname, format_type(pg_attribute.atttypid, pg_attribute.atttypmod) FROM pg_index, pg_class, pg_attribute WHERE indrelid = pg_class.oid AND pg_attribute.attrelid = pg_class.oid AND pg_attribute.attnum = any(pg_index.indkey) AND indisprimary AND pg_class.oid = '" + stName + "'::regclass";
-
-      PGresult* res = PQexec(fConnection,cmd.c_str());
+      // columns, types and primary keys in one go, from the catalog
+      // cache if there is one
+      Catalog cat;
+      GetCatalog(cat);
 
-      if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        errStr = "Table::Table(): command failed: " + std::string(PQerrorMessage(fConnection));
-        if (fVerbosity > 0)
-          std::cerr << errStr << std::endl;
-        PQclear(res);
-        CloseConnection();
+      fTestedExists = true;
+      fExistsInDB = cat.exists;
+      if (!cat.exists) {
+        errStr = "Table::Table(): table \'" + stName + "\' not found in database!";
         throw std::runtime_error(errStr);
       }
 
-      int nRow = PQntuples(res);
-      if (nRow == 0) {
+      std::vector<std::string> pkeyList = cat.pkeys;
+
+      if (pkeyList.empty()) {
         errStr = std::string("Table::Table(): no primary keys defined for table \'") + tableName + std::string("\', unable to proceed.");
-        PQclear(res);
         fExistsInDB = false;
-        CloseConnection();
         throw std::runtime_error(errStr);
       }
 
-      for (int i=0; i<nRow; ++i) {
-        std::string key = std::string(PQgetvalue(res,i,0));
-        pkeyList.push_back(key);
-      }
-
-      PQclear(res);
-
-      // now get names and types of all columns
-      this->GetColsFromDB(pkeyList);
-
-      if (!hasConn) CloseConnection();
+      SetColsFromCatalog(cat.cols,pkeyList);
 
       // now set the dB command cache file name
       std::string dirName;
@@ -248,18 +897,84 @@ namespace nutools {
 	std::cerr << "Table::GetColsFromDB() currently disabled for unstructured conditions tables." << std::endl;
 	abort();
       }
-      
+
+      Catalog cat;
+      GetCatalog(cat);
+
+      SetColsFromCatalog(cat.cols,pkeyList);
+
+      fTestedExists = true;
+      fExistsInDB = cat.exists;
+
+      return true;
+    }
+
+    //************************************************************
+    // Column names and types, serial (autoincr) flags, primary keys
+    // and whether the table exists (ExistsInDB()), with a single query.
+    // The columns of a conditions table are those of its _update
+    // table, and its primary keys those of the table itself.  If
+    // $DBICACHEDIR is set the result is kept there and later calls,
+    // from any job, read it back without connecting to the dB at all;
+    // set $DBISCHEMAVERSION to a new value when table definitions
+    // change to have it read afresh.  Throws if the query fails.
+    //************************************************************
+    void Table::GetCatalog(Catalog& cat)
+    {
+      cat.cols.clear();
+      cat.pkeys.clear();
+      cat.exists = false;
+
+      std::string key = CatalogKey();
+      std::string fname;
+      if (!key.empty()) {
+        std::ostringstream outs;
+        outs << getenv("DBICACHEDIR") << "/.dbi_catalog_" << std::hex
+             << HashSQL(key);
+        fname = outs.str();
+        if (ReadCatalogCache(fname,key,cat)) {
+          if (fVerbosity > 0)
+            std::cout << "Table::GetCatalog: read columns of " << Name()
+                      << " from " << fname << std::endl;
+          return;
+        }
+      }
+
       bool hasConn = fHasConnection;
       if (! fHasConnection) {
         GetConnection();
         hasConn = false;
       }
-      
-      // now get names and types of all columns
-      std::string cmd = "SELECT column_name, data_type from information_schema.columns where table_name = \'" + std::string(fTableName);
-      if (fTableType == kConditionsTable)
-	cmd += "_update";
-      cmd += "\' and table_schema=\'" + fSchema + "\'";
+
+      std::string tname = fTableName;
+      if (fTableType == kConditionsTable) tname += "_update";
+      std::string stName = fSchema + std::string(".") + fTableName;
+
+      // the first field says what each row is: 0 for a column, 1 for a
+      // primary key, 2 for one of the tables that must exist.  Serial
+      // columns are those with a sequence behind them; tables are named
+      // so that the query cannot fail on a missing one.
+      std::string rel = "quote_ident(c.table_schema)||'.'||quote_ident(c.table_name)";
+      std::vector<std::string> tables = RequiredTables();
+      std::string cmd = "SELECT 0, c.column_name::text, c.data_type::text, "
+        "CASE WHEN c.data_type = 'integer' THEN pg_get_serial_sequence(" +
+        rel + ",c.column_name) IS NOT NULL ELSE false END, "
+        "c.ordinal_position::int "
+        "FROM information_schema.columns c WHERE c.table_name = \'" + tname +
+        "\' and c.table_schema=\'" + fSchema + "\' "
+        "UNION ALL SELECT 1, a.attname::text, '', false, 0 "
+        "FROM pg_index i, pg_attribute a WHERE a.attrelid = i.indrelid AND "
+        "a.attnum = any(i.indkey) AND i.indisprimary AND "
+        "i.indrelid = to_regclass(\'" + stName + "\') "
+        "UNION ALL SELECT 2, tablename::text, '', false, 0 FROM pg_tables "
+        "WHERE schemaname=\'" + fSchema + "\' AND tablename IN (";
+      for (unsigned int i=0; i<tables.size(); ++i)
+        cmd += (i > 0 ? ",\'" : "\'") + tables[i] + "\'";
+      cmd += ") ORDER BY 1, 5";
+
+      if (fVerbosity > 0)
+        std::cerr << "Table::GetCatalog: Executing PGSQL command: \n\t"
+                  << cmd << std::endl;
 
       PGresult* res = PQexec(fConnection,cmd.c_str());
 
@@ -273,11 +988,138 @@ namespace nutools {
         throw std::runtime_error(errStr);
       }
 
+      unsigned int nTable = 0;
       int nRow = PQntuples(res);
+      for (int i=0; i<nRow; ++i) {
+        std::string kind = PQgetvalue(res,i,0);
+        std::string name = PQgetvalue(res,i,1);
+        if (kind == "0") {
+          CatalogCol c;
+          c.name = name;
+          c.type = PQgetvalue(res,i,2);
+          c.isSerial = (std::string(PQgetvalue(res,i,3)) == "t");
+          cat.cols.push_back(c);
+        }
+        else if (kind == "1")
+          cat.pkeys.push_back(name);
+        else if (std::find(tables.begin(),tables.end(),name) != tables.end())
+          ++nTable;
+      }
+      cat.exists = (nTable == tables.size());
+
+      PQclear(res);
+
+      if (!hasConn) CloseConnection();
+
+      // a table that is not there yet may well be soon
+      if (!fname.empty() && cat.exists && !cat.cols.empty())
+        WriteCatalogCache(fname,key,cat);
+    }
+
+    //************************************************************
+    // The tables that ExistsInDB() looks for
+    //************************************************************
+    std::vector<std::string> Table::RequiredTables() const
+    {
+      std::vector<std::string> tList;
+      std::string tname = fTableName;
+      if (fTableType != kConditionsTable)
+        tList.push_back(tname);
+      else {
+        tList.push_back(tname+std::string("_snapshot"));
+        tList.push_back(tname+std::string("_snapshot_data"));
+        tList.push_back(tname+std::string("_tag"));
+        tList.push_back(tname+std::string("_tag_snapshot"));
+        tList.push_back(tname+std::string("_update"));
+      }
+      return tList;
+    }
+
+    //************************************************************
+    // What the catalog cache of this table is filed under, or "" if
+    // there is no cache.
+    //************************************************************
+    std::string Table::CatalogKey()
+    {
+      const char* dir = getenv("DBICACHEDIR");
+      if (!dir || std::string(dir).empty() || fIgnoreDB) return "";
+
+      try {
+        if (!GetConnectionInfo()) return "";
+      }
+      catch (std::runtime_error& e) {
+        return "";
+      }
+
+      std::ostringstream key;
+      key << fDBHost << ":" << fDBPort << "/" << fDBName << " "
+          << fSchema << "." << fTableName << " type=" << fTableType;
+      const char* version = getenv("DBISCHEMAVERSION");
+      if (version) key << " version=" << version;
+
+      return key.str();
+    }
+
+    //************************************************************
+    bool Table::ReadCatalogCache(const std::string& fname,
+                                 const std::string& key, Catalog& cat)
+    {
+      std::ifstream fin(fname.c_str());
+      if (!fin.is_open()) return false;
+
+      std::string line;
+      if (!std::getline(fin,line) || line != "# nutools::dbi catalog 2")
+        return false;
+      if (!std::getline(fin,line) || line != "# " + key)
+        return false;
+
+      // only tables that exist are ever written
+      Catalog tmp;
+      tmp.exists = true;
+      while (std::getline(fin,line)) {
+        std::vector<std::string> f;
+        boost::split(f,line,boost::is_any_of("\t"));
+        if (f[0] == "col" && f.size() == 4) {
+          CatalogCol c;
+          c.name = f[1];
+          c.type = f[2];
+          c.isSerial = (f[3] == "1");
+          tmp.cols.push_back(c);
+        }
+        else if (f[0] == "pkey" && f.size() == 2)
+          tmp.pkeys.push_back(f[1]);
+        else
+          return false;
+      }
+      if (tmp.cols.empty()) return false;
+
+      cat = tmp;
+      return true;
+    }
+
+    //************************************************************
+    void Table::WriteCatalogCache(const std::string& fname,
+                                  const std::string& key,
+                                  const Catalog& cat)
+    {
+      std::ostringstream outs;
+      outs << "# nutools::dbi catalog 2\n" << "# " << key << "\n";
+      for (unsigned int i=0; i<cat.cols.size(); ++i)
+        outs << "col\t" << cat.cols[i].name << "\t" << cat.cols[i].type
+             << "\t" << cat.cols[i].isSerial << "\n";
+      for (unsigned int i=0; i<cat.pkeys.size(); ++i)
+        outs << "pkey\t" << cat.pkeys[i] << "\n";
+
+      WriteAtomically(fname,outs.str());
+    }
 
-      for (int i=0; i<nRow; ++i) {	
-        std::string cname = std::string(PQgetvalue(res,i,0));
-        std::string ctype = std::string(PQgetvalue(res,i,1));
+    //************************************************************
+    void Table::SetColsFromCatalog(const std::vector<CatalogCol>& cols,
+                                   const std::vector<std::string>& pkeyList)
+    {
+      for (unsigned int i=0; i<cols.size(); ++i) {
+        std::string cname = cols[i].name;
+        std::string ctype = cols[i].type;
 
 	if (fTableType == kConditionsTable) {	  
 	  if (cname == "__snapshot_id") continue;
@@ -294,18 +1136,9 @@ namespace nutools {
           ctype = "text"; //varchar" + ctype.substr(8,ctype.find(')')-1);
 	
         // check if this column is "auto_incr", only if !conditions table
-        if (fTableType != kConditionsTable && ctype == "integer") {
-	  std::string stName = fSchema + std::string(".") + std::string(fTableName);
-          cmd = "SELECT pg_get_serial_sequence(\'" + stName +
-            "\',\'" + cname + "\')";
-          PGresult* res2 = PQexec(fConnection,cmd.c_str());
-          int nRow2 = PQntuples(res2);
-          for (int j=0; j<nRow2; ++j) {
-            std::string tStr = std::string(PQgetvalue(res2,j,0));
-            if (tStr != "") ctype = "auto_incr";
-          }
-          PQclear(res2);
-        }
+        if (fTableType != kConditionsTable && ctype == "integer" &&
+            cols[i].isSerial)
+          ctype = "auto_incr";
 	
         // now create Column based on this info
 	ColumnDef cdef(cname,ctype);
@@ -321,11 +1154,11 @@ namespace nutools {
         if (cname == "updateuser") addUpdateUser = true;
       }
 
-      PQclear(res);
-
-      if (!hasConn) CloseConnection();
-
-      return true;
+      fPKeyList.clear();
+      for (unsigned int i=0; i<fCol.size(); ++i)
+        if (find(pkeyList.begin(),pkeyList.end(),fCol[i].Name()) != pkeyList.end())
+          fPKeyList.push_back(&fCol[i]);
+      fUpdateSQL.clear();
     }
     
     //************************************************************
@@ -341,7 +1174,16 @@ namespace nutools {
 
       ColumnDef cdef(cname,ctype);
       
+      // fPKeyList points into fCol, which may move
+      std::vector<int> pkeyIdx;
+      for (unsigned int i=0; i<fPKeyList.size(); ++i)
+        pkeyIdx.push_back(fPKeyList[i] - &fCol[0]);
+
       fCol.push_back(cdef);
+
+      for (unsigned int i=0; i<pkeyIdx.size(); ++i)
+        fPKeyList[i] = &fCol[pkeyIdx[i]];
+      fUpdateSQL.clear();
       
       if (cname == "inserttime") addInsertTime = true;
       if (cname == "insertuser") addInsertUser = true;
@@ -357,6 +1199,8 @@ namespace nutools {
     {
       if (!row) return;
 
+      FillRowViews();
+
       Row r2(*row);
 
       for (unsigned int i=0; i<fCol.size(); ++i) {
@@ -377,27 +1221,313 @@ namespace nutools {
 
     void Table::AddEmptyRows(unsigned int nrow)
     {
+      FillRowViews();
+
       Row* row = this->NewRow();
 
       fRow.resize(fRow.size()+nrow,*row);
+      delete row;
     }
 
     //************************************************************
-    void Table::AddRow(const Row& row)
+    // Append nrow empty rows to the columnar storage, returning the
+    // index of the first new row
+    //************************************************************
+    unsigned int Table::AddStoreRows(unsigned int nrow)
     {
-      AddRow(&row);
+      if (fStore.NRow() == 0) fStore.Reset(fCol);
+
+      unsigned int ioff = fStore.NRow();
+      fStore.Resize(ioff+nrow);
+
+      return ioff;
     }
 
     //************************************************************
-    bool Table::RemoveRow(int i)
+    // Create Row views for any rows that so far only exist in the
+    // columnar storage.  The views do not copy any values.
+    //************************************************************
+    void Table::BuildRowViews()
     {
-      if (i < 0) return false;
+      unsigned int nstore = fStore.NRow();
+      unsigned int ioff = fRow.size();
 
-      unsigned int j = i;
+      Row* row = this->NewRow();
+      fRow.resize(ioff+nstore-fNRowViews,*row);
+      delete row;
+
+      for (unsigned int i=fNRowViews; i<nstore; ++i) {
+        Row& r = fRow[ioff+i-fNRowViews];
+        for (unsigned int j=0; j<fCol.size(); ++j)
+          r.Col(j).SetView(&fStore,i,j);
+        if (fStore.IsVldRow(i)) {
+          r.SetChannel(fStore.Channel(i));
+          r.SetVldTime(fStore.VldTime(i));
+          if (fStore.HasVldTimeEnd(i))
+            r.SetVldTimeEnd(fStore.VldTimeEnd(i));
+        }
+        if (fStore.InDB(i)) r.SetInDB();
+      }
 
-      if (j >= fRow.size()) return false;
+      fNRowViews = nstore;
+    }
 
-      unsigned int kEnd = fNullList.size();
+    //************************************************************
+    bool Table::SaveSnapshot(const std::string& fname)
+    {
+      // a table that was only ever loaded in columnar mode is written
+      // as it is; otherwise the rows are copied into a store of their own
+      ColumnStore rows;
+      const ColumnStore* store = &fStore;
+      if (!fRow.empty() || fStore.NCol() != fCol.size()) {
+        FillRowViews();
+        rows.Reset(fCol);
+        rows.Resize(fRow.size());
+        for (unsigned int i=0; i<fRow.size(); ++i) {
+          Row& r = fRow[i];
+          for (unsigned int j=0; j<fCol.size(); ++j)
+            if (!r.Col(j).IsNull()) rows.SetFromString(i,j,r.Col(j).Value());
+          if (r.IsVldRow()) {
+            rows.SetChannel(i,r.Channel());
+            rows.SetVldTime(i,r.VldTime());
+            if (r.VldTimeEnd() > r.VldTime())
+              rows.SetVldTimeEnd(i,r.VldTimeEnd());
+          }
+          if (r.InDB()) rows.SetInDB(i);
+        }
+        store = &rows;
+      }
+
+      std::vector<ColumnStore::Section> sect;
+      store->GetSections(sect);
+
+      // the channel index goes along (empty for other tables), so that
+      // FillChanRowMap() on the mapped table does not sort again
+      std::vector<uint64_t> chanKey;
+      std::vector<unsigned int> chanOffset;
+      std::vector<unsigned int> chanRow;
+      std::vector<double> chanTime;
+      std::vector<double> chanMaxEnd;
+      if ((fTableType == kConditionsTable ||
+           fTableType == kUnstructuredConditionsTable) && store->NRow() > 0)
+        MakeChanIndex(store->NRow(),
+                      [store](unsigned int i, uint64_t& chan, double& tv,
+                              double& end) {
+                        chan = store->Channel(i);
+                        tv = store->VldTime(i);
+                        end = store->VldTimeEnd(i);
+                        if (!(end > tv))
+                          end = std::numeric_limits<double>::infinity();
+                      },
+                      chanKey,chanOffset,chanRow,chanTime,chanMaxEnd);
+      sect.push_back(ColumnStore::Section(chanKey.data(),
+                                          chanKey.size()*sizeof(uint64_t)));
+      sect.push_back(ColumnStore::Section(chanOffset.data(),
+                                          chanOffset.size()*sizeof(uint32_t)));
+      sect.push_back(ColumnStore::Section(chanRow.data(),
+                                          chanRow.size()*sizeof(uint32_t)));
+      sect.push_back(ColumnStore::Section(chanTime.data(),
+                                          chanTime.size()*sizeof(double)));
+      sect.push_back(ColumnStore::Section(chanMaxEnd.data(),
+                                          chanMaxEnd.size()*sizeof(double)));
+
+      std::ostringstream metass;
+      metass << fTableName << "\n" << fSchema << "\n" << fTag << "\n";
+      for (unsigned int j=0; j<fCol.size(); ++j)
+        metass << fCol[j].Name() << "\t" << fCol[j].Type() << "\t"
+               << store->Type(j) << "\n";
+      std::string meta = metass.str();
+
+      SnapshotHeader h;
+      memset(&h,0,sizeof(h));
+      memcpy(h.magic,kSnapshotMagic,sizeof(h.magic));
+      h.version = kSnapshotVersion;
+      h.byteOrder = kSnapshotByteOrder;
+      h.nrow = store->NRow();
+      h.ncol = fCol.size();
+      h.tableType = fTableType;
+      h.dataTypeMask = fDataTypeMask;
+      h.minTSVld = fMinTSVld;
+      h.maxTSVld = fMaxTSVld;
+      h.metaSize = meta.size();
+
+      std::vector<uint64_t> dir(2*sect.size());
+      uint64_t pos = Align8(sizeof(h) + meta.size()) + dir.size()*sizeof(uint64_t);
+      for (unsigned int i=0; i<sect.size(); ++i) {
+        dir[2*i] = pos;
+        dir[2*i+1] = sect[i].second;
+        pos = Align8(pos + sect[i].second);
+      }
+
+      // as WriteAtomically(), but without holding it all in memory
+      std::string tmpName = TempName(fname);
+      std::ofstream fout(tmpName.c_str(),std::ios::binary);
+      if (!fout.is_open()) {
+        std::cerr << "Table::SaveSnapshot: cannot write " << tmpName
+                  << std::endl;
+        return false;
+      }
+
+      const char pad[8] = {0};
+      fout.write((const char*)&h,sizeof(h));
+      fout.write(meta.data(),meta.size());
+      fout.write(pad,Align8(sizeof(h) + meta.size()) - sizeof(h) - meta.size());
+      fout.write((const char*)dir.data(),dir.size()*sizeof(uint64_t));
+      for (unsigned int i=0; i<sect.size(); ++i) {
+        if (sect[i].second == 0) continue;
+        fout.write((const char*)sect[i].first,sect[i].second);
+        fout.write(pad,Align8(sect[i].second) - sect[i].second);
+      }
+      fout.close();
+
+      if (fout.fail() || rename(tmpName.c_str(),fname.c_str()) != 0) {
+        std::cerr << "Table::SaveSnapshot: failed to write " << fname
+                  << std::endl;
+        unlink(tmpName.c_str());
+        return false;
+      }
+
+      return true;
+    }
+
+    //************************************************************
+    bool Table::MapSnapshot(const std::string& fname)
+    {
+      int fd = open(fname.c_str(),O_RDONLY);
+      if (fd < 0) {
+        std::cerr << "Table::MapSnapshot: cannot open " << fname << std::endl;
+        return false;
+      }
+
+      struct stat st;
+      void* addr = MAP_FAILED;
+      size_t size = 0;
+      if (fstat(fd,&st) == 0 && st.st_size >= (off_t)sizeof(SnapshotHeader)) {
+        size = st.st_size;
+        addr = mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0);
+      }
+      close(fd);  // the mapping does not need it
+
+      if (addr == MAP_FAILED) {
+        std::cerr << "Table::MapSnapshot: cannot map " << fname << std::endl;
+        return false;
+      }
+      std::shared_ptr<const void> mapping =
+        std::make_shared<SnapshotMapping>(addr,size);
+      const char* base = (const char*)addr;
+
+      SnapshotHeader h;
+      memcpy(&h,base,sizeof(h));
+      if (memcmp(h.magic,kSnapshotMagic,sizeof(h.magic)) != 0 ||
+          h.version != kSnapshotVersion ||
+          h.byteOrder != kSnapshotByteOrder) {
+        std::cerr << "Table::MapSnapshot: " << fname
+                  << " is not a snapshot this version can read" << std::endl;
+        return false;
+      }
+
+      // everything from here on must lie inside the file
+      bool isOk = (h.nrow <= std::numeric_limits<unsigned int>::max() &&
+                   h.ncol < size && h.metaSize < size);
+      uint64_t nsect = 4 + 4*h.ncol + 5;
+      uint64_t dirPos = Align8(sizeof(h) + h.metaSize);
+      isOk = isOk && (dirPos + nsect*2*sizeof(uint64_t) <= size);
+
+      std::vector<std::string> cname;
+      std::vector<std::string> ctype;
+      std::vector<int> stype;
+      std::string name, schema, tag;
+      if (isOk) {
+        std::istringstream metass(std::string(base+sizeof(h),h.metaSize));
+        std::getline(metass,name);
+        std::getline(metass,schema);
+        std::getline(metass,tag);
+        std::string line;
+        while (std::getline(metass,line)) {
+          std::vector<std::string> f;
+          boost::split(f,line,boost::is_any_of("\t"));
+          if (f.size() != 3) break;
+          cname.push_back(f[0]);
+          ctype.push_back(f[1]);
+          stype.push_back(atoi(f[2].c_str()));
+        }
+        isOk = (cname.size() == h.ncol);
+      }
+
+      std::vector<ColumnStore::Section> sect;
+      for (uint64_t i=0; i<nsect && isOk; ++i) {
+        uint64_t d[2];
+        memcpy(d,base+dirPos+2*i*sizeof(uint64_t),sizeof(d));
+        isOk = (d[0] % 8 == 0 && d[0] <= size && d[1] <= size - d[0]);
+        sect.push_back(ColumnStore::Section(base+d[0],d[1]));
+      }
+
+      if (!isOk) {
+        std::cerr << "Table::MapSnapshot: " << fname << " is corrupt"
+                  << std::endl;
+        return false;
+      }
+
+      // a table that already has columns must have these ones
+      if (!fCol.empty() || (!fTableName.empty() && fTableName != name)) {
+        bool isSame = (fCol.size() == cname.size() &&
+                       (fTableName.empty() || fTableName == name));
+        for (unsigned int i=0; i<fCol.size() && isSame; ++i)
+          isSame = (fCol[i].Name() == cname[i] && fCol[i].Type() == ctype[i]);
+        if (!isSame) {
+          std::cerr << "Table::MapSnapshot: " << fname << " holds table "
+                    << name << ", whose columns are not those of table "
+                    << fTableName << std::endl;
+          return false;
+        }
+      }
+
+      ClearRows();
+      ClearChanRowMap();
+      if (fCol.empty())
+        for (unsigned int i=0; i<cname.size(); ++i) AddCol(cname[i],ctype[i]);
+
+      std::vector<ColumnStore::Section> index(sect.end()-5,sect.end());
+      sect.resize(sect.size()-5);
+      if (!fStore.View(h.nrow,stype,sect,mapping)) {
+        std::cerr << "Table::MapSnapshot: " << fname << " is corrupt"
+                  << std::endl;
+        return false;
+      }
+
+      if (fTableName.empty()) fTableName = name;
+      if (fSchema == "undef") fSchema = schema;
+      fTag = tag;
+      fTableType = h.tableType;
+      fDataTypeMask = h.dataTypeMask;
+      fMinTSVld = h.minTSVld;
+      fMaxTSVld = h.maxTSVld;
+      fColumnarStorage = true;
+      fValidityChanged = false;
+      fSnapIndex.swap(index);
+      fSnapMapping = mapping;
+
+      return true;
+    }
+
+    //************************************************************
+    void Table::AddRow(const Row& row)
+    {
+      AddRow(&row);
+    }
+
+    //************************************************************
+    bool Table::RemoveRow(int i)
+    {
+      if (i < 0) return false;
+
+      FillRowViews();
+
+      unsigned int j = i;
+
+      if (j >= fRow.size()) return false;
+
+      unsigned int kEnd = fNullList.size();
       for (unsigned int k=0; k<kEnd; ++k)
         if (fNullList[k].first == i) {
           fNullList.erase(fNullList.begin()+k);
@@ -411,6 +1541,17 @@ namespace nutools {
 
     //************************************************************
     Row* const Table::GetRow(int i)
+    {
+      FillRowViews();
+
+      if (i >= 0 && i < (int)fRow.size())
+        return &fRow[i];
+      else
+        return 0;
+    }
+
+    //************************************************************
+    const Row* Table::GetRow(int i) const
     {
       if (i >= 0 && i < (int)fRow.size())
         return &fRow[i];
@@ -466,6 +1607,7 @@ namespace nutools {
     //************************************************************
     void Table::Reset()
     {
+      if (!fPoolKey.empty()) CloseConnection();
       fConnection = 0;
       fHasConnection = 0;
       fPKeyList.clear();
@@ -574,7 +1716,7 @@ namespace nutools {
     }
 
     //************************************************************
-    const nutools::dbi::ColumnDef* Table::GetCol(std::string& cname)
+    const nutools::dbi::ColumnDef* Table::GetCol(std::string& cname) const
     {
       unsigned int i=0;
       for ( ; i < fCol.size(); ++i)
@@ -586,7 +1728,7 @@ namespace nutools {
     }
 
     //************************************************************
-    int Table::GetColIndex(std::string cname) 
+    int Table::GetColIndex(std::string cname) const
     {
       for (unsigned int i=0; i<fCol.size(); ++i)
 	if (fCol[i].Name() == cname) return (int)i;
@@ -595,7 +1737,7 @@ namespace nutools {
     }
 
     //************************************************************
-    std::map<std::string,int> Table::GetColNameToIndexMap()
+    std::map<std::string,int> Table::GetColNameToIndexMap() const
     {
       std::map<std::string,int> tmap;
       for (unsigned int i=0; i<fCol.size(); ++i) {
@@ -605,7 +1747,7 @@ namespace nutools {
     }
 
     //************************************************************
-    std::vector<std::string> Table::GetColNames()
+    std::vector<std::string> Table::GetColNames() const
     {
       std::vector<std::string> nameList;
 
@@ -758,6 +1900,17 @@ namespace nutools {
     //************************************************************
     bool Table::GetConnection(int ntry)
     {
+      return GetConnection(ntry,true);
+    }
+
+    //************************************************************
+    // As above, but if waitForPool is false and the connection pool is
+    // full, give up at once (setting fPoolBusy) rather than waiting for
+    // a connection or opening a private one.
+    //************************************************************
+    bool Table::GetConnection(int ntry, bool waitForPool)
+    {
+      fPoolBusy = false;
       if (fIgnoreDB) return false;
 
       bool gotConnInfo = false;
@@ -798,6 +1951,27 @@ namespace nutools {
         if (fPassword != "")
           cmd += " password = " + fPassword;
 
+        if (fConnectionPool) {
+          std::string key = cmd + " role = " + fRole;
+          int timeout = (waitForPool ? fConnectionTimeout : 0);
+          if (fConnectionPool->Borrow(key,fConnection,timeout)) {
+            fPoolKey = key;
+            if (fConnection) {
+              fHasConnection = true;
+              if (fVerbosity > 0)
+                std::cout << "Got pooled connection" << std::endl;
+              return true;
+            }
+          }
+          else if (!waitForPool) {
+            fPoolBusy = true;
+            return false;
+          }
+          else
+            std::cerr << "Table::GetConnection: connection pool is full, "
+                      << "opening a private connection." << std::endl;
+        }
+
         fConnection = PQconnectdb(cmd.c_str());
 
         int nTry=0;
@@ -811,7 +1985,7 @@ namespace nutools {
                     << fDBName << " failed: "
                     << PQerrorMessage(fConnection) << std::endl;
 	  
-          CloseConnection();	  
+          PQfinish(fConnection);
           sleepTime = 1 + ((double)random()/(double)RAND_MAX)*(1 << nTry++);
           sleep(sleepTime);
 	  t1 = time(NULL);
@@ -819,7 +1993,7 @@ namespace nutools {
         }
         if (PQstatus(fConnection) != CONNECTION_OK) {
 	  CloseConnection();
-	  if (! GetConnection(ntry+1)) {
+	  if (! GetConnection(ntry+1,waitForPool)) {
 	    std::cerr << "Too many attempts to connect to the database, " 
 		      << ", giving up." << std::endl;
 	    CloseConnection();
@@ -836,7 +2010,13 @@ namespace nutools {
     //************************************************************
     bool Table::CloseConnection()
     {
-      if (fConnection) {
+      if (!fPoolKey.empty()) {
+        fConnectionPool->Return(fPoolKey,fConnection);
+        fPoolKey.clear();
+        if (fVerbosity > 0)
+          std::cout << "Returned connection to pool" << std::endl;
+      }
+      else if (fConnection) {
         PQfinish(fConnection);
         if (fVerbosity > 0)
           std::cout << "Closed connection" << std::endl;
@@ -906,8 +2086,14 @@ namespace nutools {
         hasConn = false;
       }
 
+      std::vector<std::string> tList = RequiredTables();
+
+      // only ask for the tables we are looking for, not the whole schema
       std::string cmd = "SELECT tablename FROM pg_tables WHERE schemaname=\'" +
-        fSchema + "\'";
+        fSchema + "\' AND tablename IN (";
+      for (unsigned int i=0; i<tList.size(); ++i)
+        cmd += (i > 0 ? ",\'" : "\'") + tList[i] + "\'";
+      cmd += ")";
       //  std::cout << tname << ": " << cmd << std::endl;
       PGresult* res = PQexec(fConnection,cmd.c_str());
 
@@ -925,12 +2111,6 @@ namespace nutools {
       int nRow = PQntuples(res);
 
       int tc=0;
-      std::vector<std::string> tList;
-      tList.push_back(tname+std::string("_snapshot"));
-      tList.push_back(tname+std::string("_snapshot_data"));
-      tList.push_back(tname+std::string("_tag"));
-      tList.push_back(tname+std::string("_tag_snapshot"));
-      tList.push_back(tname+std::string("_update"));
 
       for (int i=0; i<nRow; ++i) {
         //    std::cout << string(PQgetvalue(res,i,0)) << std::endl;
@@ -1069,55 +2249,20 @@ namespace nutools {
     }
 
     //************************************************************
-    bool Table::LoadFromDB()
+    ResultStream Table::StreamSQL(const std::string& cmd)
     {
-      if (fIgnoreDB) return false;
-
-      if (fSchema == "undef") {
-        std::cerr << "Table::LoadFromDB: Detector not set!  Table::SetDetector()"
-                  << " must be called first!" << std::endl;
-        return false;
-      }
-
-      if (!fValidityChanged) return true;
-
-      // make a connection to the dB if there isn't one already
-      bool hasConn = fHasConnection;
-      if (! fHasConnection) {
-        GetConnection();
-        hasConn = false;
-      }
-
-      if (!fConnection) {
-        std::cerr << "Table::LoadFromDB: No connection to the database!" << std::endl;
-        return false;
-      }
-
-      if (!ExistsInDB()) {
-        std::cerr << "Table::LoadFromDB: Table \"" << Name()
-                  << "\" not found in database!" << std::endl;
-        CloseConnection();
-        return false;
-      }
-
-      std::string cmd;
-      cmd.clear();
-      PGresult* res;
+      return ResultStream(this,cmd);
+    }
 
+    //************************************************************
+    // Build the SELECT used by LoadFromDB().  If params is given, the
+    // validity values are left as $n parameters and appended to it, so
+    // that the statement only depends on the shape of the query.
+    //************************************************************
+    std::string Table::MakeSelectSQL(std::vector<std::string>* params)
+    {
       std::ostringstream outs;
-      outs << "BEGIN";
-      res = PQexec(fConnection, outs.str().c_str());
-      if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-        std::cerr << "BEGIN command failed: " << PQerrorMessage(fConnection) << std::endl;
-        PQclear(res);
-        CloseConnection();
-        return false;
-      }
-
-      PQclear(res);
-
-      outs.str("");
-      outs << "DECLARE myportal CURSOR FOR SELECT ";
+      outs << "SELECT ";
       if (!fDistinctCol.empty()) {
         outs << "DISTINCT ON (";
         if (! fDistinctCol.empty()) {
@@ -1150,16 +2295,28 @@ namespace nutools {
           else
             outs << "=";
 
-	  if (needsQuotes) outs << "'";
-          outs << fValidityStart[i].Value();
-	  if (needsQuotes) outs << "'";
+	  if (params) {
+	    params->push_back(fValidityStart[i].Value());
+	    outs << "$" << params->size();
+	  }
+	  else {
+	    if (needsQuotes) outs << "'";
+	    outs << fValidityStart[i].Value();
+	    if (needsQuotes) outs << "'";
+	  }
 	  
           if (!isEqualTo) {
             outs << " and ";
             outs << fValidityEnd[i].Name() + "<=";
-	    if (needsQuotes) outs << "'";
-            outs << fValidityEnd[i].Value();
-	    if (needsQuotes) outs << "'";
+	    if (params) {
+	      params->push_back(fValidityEnd[i].Value());
+	      outs << "$" << params->size();
+	    }
+	    else {
+	      if (needsQuotes) outs << "'";
+	      outs << fValidityEnd[i].Value();
+	      if (needsQuotes) outs << "'";
+	    }
           }
 
           if (i < (fValidityStart.size()-1)) outs << " and ";
@@ -1197,40 +2354,73 @@ namespace nutools {
         outs << " OFFSET " << boost::lexical_cast<std::string>(fSelectOffset);
       }
 
-      if (fVerbosity > 0)
-        std::cerr << "Table::LoadFromDB: Executing PGSQL command: \n\t" << outs.str() << std::endl;
-      res = PQexec(fConnection,outs.str().c_str());
+      return outs.str();
+    }
 
-      if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-        std::cerr << "DECLARE CURSOR failed: " << PQerrorMessage(fConnection) << std::endl;
-        PQclear(res);
-        CloseConnection();
-        return false;
-      }
-      PQclear(res);
+    //************************************************************
+    // Prepare sql on the current connection, unless that has already
+    // been done, and return the statement name; "" on failure.  The
+    // statements prepared on each connection are kept with the
+    // connection itself, so Tables sharing a connection share them and
+    // they go away when it is closed.
+    //************************************************************
+    std::string Table::PrepareStatement(const std::string& sql, int nparam)
+    {
+      StatementMap* stmts = PreparedStatements(fConnection);
+      if (!stmts) return std::string("");
 
+      char name[32];
+      snprintf(name,sizeof(name),"dbi_%016" PRIx64,HashSQL(sql));
 
-      boost::posix_time::ptime ctt1;
-      boost::posix_time::ptime ctt2;
-    
-      if (fTimeQueries) {
-	ctt1 = boost::posix_time::microsec_clock::local_time();
+      StatementMap::iterator itr = stmts->find(name);
+      if (itr != stmts->end()) {
+        if (itr->second == sql) return std::string(name);
+        return std::string("");  // hash collision, don't prepare
       }
 
-      res = PQexec(fConnection, "FETCH ALL in myportal");
-      if (fTimeQueries) {
-	ctt2 = boost::posix_time::microsec_clock::local_time();
-	boost::posix_time::time_duration tdiff = ctt2 - ctt1;
-	std::cerr << "Table::LoadFromDB(" << Name() << "): query took " 
-		  << tdiff.total_milliseconds() << " ms" << std::endl;
-      }
+      if (fVerbosity > 0)
+        std::cerr << "Table::PrepareStatement: preparing " << name << ": \n\t"
+                  << sql << std::endl;
+
+      PGresult* res = PQprepare(fConnection,name,sql.c_str(),nparam,NULL);
+      bool isOk = (PQresultStatus(res) == PGRES_COMMAND_OK);
+      if (!isOk)
+        std::cerr << "PREPARE failed: " << PQerrorMessage(fConnection)
+                  << std::endl;
+      PQclear(res);
 
-      if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        std::cerr << "FETCH ALL failed: %" << PQerrorMessage(fConnection) << std::endl;
-        PQclear(res);
-        CloseConnection();
+      if (!isOk) return std::string("");
+
+      (*stmts)[name] = sql;
+      return std::string(name);
+    }
+
+    //************************************************************
+    // True if the results described by desc (from PQdescribePortal() or
+    // PQdescribePrepared()) can be fetched in binary format, ie. if we
+    // can decode every column we are going to load.
+    //************************************************************
+    bool Table::CanLoadBinary(const PGresult* desc)
+    {
+      const char* idt = PQparameterStatus(fConnection,"integer_datetimes");
+      if (PQresultStatus(desc) != PGRES_COMMAND_OK || !idt || strcmp(idt,"on"))
         return false;
+
+      for (unsigned int i=0; i<fCol.size(); ++i) {
+        int k = PQfnumber(desc,fCol[i].Name().c_str());
+        if (k >= 0 && !IsBinaryDecodable(PQftype(desc,k)))
+          return false;
       }
+      return true;
+    }
+
+    //************************************************************
+    // Append the rows of a SELECT result to the table.
+    //************************************************************
+    void Table::CacheRows(const PGresult* res, bool isBinary)
+    {
+      boost::posix_time::ptime ctt1;
+      boost::posix_time::ptime ctt2;
 
       // now cache rows
       int nRow = PQntuples(res);
@@ -1250,22 +2440,53 @@ namespace nutools {
 
         int k;
 
-        unsigned int ioff = fRow.size();
-        AddEmptyRows(nRow);
+        if (fColumnarStorage) {
+          unsigned int ioff = AddStoreRows(nRow);
 
-        for (int i=0; i < nRow; i++) {
+          // fill one column at a time, each is a contiguous array
           for (unsigned int j=0; j < fCol.size(); j++) {
             k = colMap[j];
-            if (k >= 0) {
-              if (! PQgetisnull(res,i,k)) {
-                std::string vstr = PQgetvalue(res,i,k);
-                fRow[ioff+i].Col(j).FastSet(vstr);
+            if (k < 0) continue;
+            Oid oid = PQftype(res,k);
+            for (int i=0; i < nRow; i++) {
+              if (PQgetisnull(res,i,k)) continue;
+              if (isBinary)
+                SetFromBinary(fStore,ioff+i,j,oid,PQgetvalue(res,i,k),
+                              PQgetlength(res,i,k));
+              else
+                fStore.SetFromString(ioff+i,j,PQgetvalue(res,i,k),
+                                     PQgetlength(res,i,k));
+            }
+          }
+          for (int i=0; i < nRow; i++)
+            fStore.SetInDB(ioff+i);
+        }
+        else {
+          unsigned int ioff = fRow.size();
+          AddEmptyRows(nRow);
+
+          std::vector<Oid> oid(fCol.size());
+          for (unsigned int j=0; j < fCol.size(); j++)
+            if (colMap[j] >= 0) oid[j] = PQftype(res,colMap[j]);
+
+          char buf[64];
+          for (int i=0; i < nRow; i++) {
+            for (unsigned int j=0; j < fCol.size(); j++) {
+              k = colMap[j];
+              if (k >= 0) {
+                if (! PQgetisnull(res,i,k)) {
+                  const char* v = PQgetvalue(res,i,k);
+                  int len = PQgetlength(res,i,k);
+                  if (isBinary)
+                    len = BinaryToText(oid[j],v,len,buf,sizeof(buf));
+                  fRow[ioff+i].Col(j).FastSet(v,len,fArena);
+                }
+                //              else
+                //                fRow[ioff+i].Col(j).FastSet("");
               }
-	      //              else
-	      //                fRow[ioff+i].Col(j).FastSet("");
             }
+            fRow[ioff+i].SetInDB();
           }
-	  fRow[ioff+i].SetInDB();
         }
       }
 
@@ -1275,61 +2496,269 @@ namespace nutools {
 	std::cerr << "Table::LoadFromDB(" << Name() << "): parsing took " 
 		  << tdiff.total_milliseconds() << " ms" << std::endl;
       }
-
-      PQclear(res);
-
-      /* close the portal ... we don't bother to check for errors ... */
-      res = PQexec(fConnection, "CLOSE myportal");
-      PQclear(res);
-
-      /* end the transaction */
-      res = PQexec(fConnection, "END");
-      PQclear(res);
-
-      // close connection to the dB if necessary
-      if (! hasConn) CloseConnection();
-
-      fValidityChanged = false;
-
-      return true;
     }
 
     //************************************************************
-    bool Table::LoadFromCSV(std::string fname)
+    bool Table::LoadFromDB()
     {
-      std::cout << "Reading " << fname << std::endl;
+      if (fIgnoreDB) return false;
 
-      std::ifstream fin;
-      fin.open(fname.c_str());
-      if (!fin.is_open()) {
-        std::cerr << "Could not open " << fname << std::endl;
+      if (fSchema == "undef") {
+        std::cerr << "Table::LoadFromDB: Detector not set!  Table::SetDetector()"
+                  << " must be called first!" << std::endl;
         return false;
       }
-      if (!fin.good()) {
-	std::cerr << "Stream not good " << fname << std::endl;
-	return false;
-      }
-      
-      std::string s;
-      
-      char buff[256];
-      std::string value;
 
-      std::vector<int> colMap(fCol.size());
-      for (unsigned int i=0; i<fCol.size(); ++i) {
-        colMap[i] = int(i);
+      if (!fValidityChanged) return true;
+
+      // make a connection to the dB if there isn't one already
+      bool hasConn = fHasConnection;
+      if (! fHasConnection) {
+        GetConnection();
+        hasConn = false;
       }
-      
-      bool hasColNames = true;
-      bool hasTols = true;
 
-      int chanIdx=-1;
-      int tvIdx=-1;
-      int tvEndIdx=-1;
+      if (!fConnection) {
+        std::cerr << "Table::LoadFromDB: No connection to the database!" << std::endl;
+        return false;
+      }
 
-      // check first line to see if it is column names.  Should begin with a '#'
-      std::getline(fin,s);
-      if (s[0] == '#' || fTableType == kConditionsTable) {
+      if (!ExistsInDB()) {
+        std::cerr << "Table::LoadFromDB: Table \"" << Name()
+                  << "\" not found in database!" << std::endl;
+        CloseConnection();
+        return false;
+      }
+
+      PGresult* res;
+
+      std::ostringstream outs;
+      boost::posix_time::ptime ctt1;
+      boost::posix_time::ptime ctt2;
+
+      // with prepared statements the SELECT is run directly, otherwise
+      // through a cursor
+      std::string stmtName;
+      std::vector<std::string> params;
+      std::vector<const char*> paramValues;
+      if (fPrepareStatements) {
+        std::string sql = MakeSelectSQL(&params);
+        stmtName = PrepareStatement(sql,params.size());
+        for (unsigned int i=0; i<params.size(); ++i)
+          paramValues.push_back(params[i].c_str());
+      }
+      // streaming needs a cursor, so skip any prepared statement
+      bool isStreaming = (fFetchSize > 0 || fRowSink);
+      if (isStreaming) stmtName.clear();
+      bool useCursor = stmtName.empty();
+
+      // cursor names are unique, and we only start (and end) a
+      // transaction if there isn't one already, so that several tables
+      // can stream over the same connection at once
+      char cursor[32];
+      snprintf(cursor,sizeof(cursor),"dbi_cursor_%u",++gCursorCount);
+      bool ownTxn = (PQtransactionStatus(fConnection) == PQTRANS_IDLE);
+
+      if (useCursor) {
+        if (ownTxn) {
+          res = PQexec(fConnection, "BEGIN");
+          if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            std::cerr << "BEGIN command failed: " << PQerrorMessage(fConnection) << std::endl;
+            PQclear(res);
+            CloseConnection();
+            return false;
+          }
+
+          PQclear(res);
+        }
+
+        outs << "DECLARE " << cursor << " CURSOR FOR " << MakeSelectSQL();
+
+        if (fVerbosity > 0)
+          std::cerr << "Table::LoadFromDB: Executing PGSQL command: \n\t" << outs.str() << std::endl;
+        res = PQexec(fConnection,outs.str().c_str());
+
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+          std::cerr << "DECLARE CURSOR failed: " << PQerrorMessage(fConnection) << std::endl;
+          PQclear(res);
+          CloseConnection();
+          return false;
+        }
+        PQclear(res);
+      }
+
+      // only ask for binary results if we can decode every column we
+      // are going to load
+      bool isBinary = false;
+      if (fBinaryTransfer) {
+        if (useCursor)
+          res = PQdescribePortal(fConnection,cursor);
+        else
+          res = PQdescribePrepared(fConnection,stmtName.c_str());
+        isBinary = CanLoadBinary(res);
+        PQclear(res);
+        if (!isBinary && fVerbosity > 0)
+          std::cerr << "Table::LoadFromDB(" << Name() << "): cannot decode "
+                    << "binary results, using text." << std::endl;
+      }
+
+      std::ostringstream fetch;
+      if (fFetchSize > 0)
+        fetch << "FETCH " << fFetchSize << " in " << cursor;
+      else
+        fetch << "FETCH ALL in " << cursor;
+
+      // rows handed to a sink are not kept, and are parsed in row mode
+      // so that there is a Row to hand over
+      bool columnarStorage = fColumnarStorage;
+      if (fRowSink) {
+        fColumnarStorage = false;
+        // rows of the store that have no view yet must get it before
+        // the first batch, or they would be handed to the sink with it
+        FillRowViews();
+      }
+
+      // what to go back to if a FETCH fails part way, or after each
+      // batch given to a sink, so that its values do not pile up
+      unsigned int nRow0 = fRow.size();
+      unsigned int nStore0 = fStore.NRow();
+      unsigned int nRowViews0 = fNRowViews;
+      Arena::Mark arena0 = fArena.GetMark();
+
+      boost::posix_time::time_duration queryTime;
+      bool isDone = false;
+      while (!isDone) {
+        if (fTimeQueries) {
+          ctt1 = boost::posix_time::microsec_clock::local_time();
+        }
+
+        if (!useCursor)
+          res = PQexecPrepared(fConnection, stmtName.c_str(), params.size(),
+                               (paramValues.empty() ? NULL : &paramValues[0]),
+                               NULL, NULL, (isBinary ? 1 : 0));
+        else if (isBinary)
+          res = PQexecParams(fConnection, fetch.str().c_str(),
+                             0, NULL, NULL, NULL, NULL, 1);
+        else
+          res = PQexec(fConnection, fetch.str().c_str());
+        if (fTimeQueries) {
+          ctt2 = boost::posix_time::microsec_clock::local_time();
+          queryTime += ctt2 - ctt1;
+        }
+
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+          std::cerr << (useCursor ? "FETCH" : "SELECT") << " failed: "
+                    << PQerrorMessage(fConnection) << std::endl;
+          PQclear(res);
+          fColumnarStorage = columnarStorage;
+          // drop the batches that did arrive, rather than return false
+          // with part of the table loaded
+          fRow.erase(fRow.begin()+nRow0,fRow.end());
+          fStore.Resize(nStore0);
+          fNRowViews = nRowViews0;
+          fArena.Rewind(arena0);
+          CloseConnection();
+          return false;
+        }
+
+        int nRow = PQntuples(res);
+        isDone = (fFetchSize <= 0 || nRow < fFetchSize);
+
+        unsigned int ioff = fRow.size();
+        CacheRows(res,isBinary);
+        PQclear(res);
+
+        if (fRowSink) {
+          for (unsigned int i=ioff; i<fRow.size(); ++i)
+            if (!fRowSink(fRow[i])) {
+              isDone = true;
+              break;
+            }
+          fRow.erase(fRow.begin()+ioff,fRow.end());
+          fArena.Rewind(arena0);
+        }
+      }
+      fColumnarStorage = columnarStorage;
+
+      if (fTimeQueries)
+        std::cerr << "Table::LoadFromDB(" << Name() << "): query took "
+                  << queryTime.total_milliseconds() << " ms" << std::endl;
+
+      if (useCursor) {
+        /* close the portal ... we don't bother to check for errors ... */
+        std::string cmd = std::string("CLOSE ") + cursor;
+        res = PQexec(fConnection, cmd.c_str());
+        PQclear(res);
+
+        /* end the transaction */
+        if (ownTxn) {
+          res = PQexec(fConnection, "END");
+          PQclear(res);
+        }
+      }
+
+      // close connection to the dB if necessary
+      if (! hasConn) CloseConnection();
+
+      fValidityChanged = false;
+
+      return true;
+    }
+
+    //************************************************************
+    std::future<bool> Table::LoadAsync(AsyncLoader& loader)
+    {
+      return loader.Add(*this);
+    }
+
+    //************************************************************
+    std::future<bool> Table::LoadAsync()
+    {
+      return AsyncLoader::Default().Add(*this);
+    }
+
+    //************************************************************
+    bool Table::WaitAll()
+    {
+      return AsyncLoader::Default().WaitAll();
+    }
+
+    //************************************************************
+    bool Table::LoadFromCSV(std::string fname)
+    {
+      std::cout << "Reading " << fname << std::endl;
+
+      std::ifstream fin;
+      fin.open(fname.c_str());
+      if (!fin.is_open()) {
+        std::cerr << "Could not open " << fname << std::endl;
+        return false;
+      }
+      if (!fin.good()) {
+	std::cerr << "Stream not good " << fname << std::endl;
+	return false;
+      }
+      
+      std::string s;
+      
+      char buff[256];
+      std::string value;
+
+      std::vector<int> colMap(fCol.size());
+      for (unsigned int i=0; i<fCol.size(); ++i) {
+        colMap[i] = int(i);
+      }
+      
+      bool hasColNames = true;
+      bool hasTols = true;
+
+      int chanIdx=-1;
+      int tvIdx=-1;
+      int tvEndIdx=-1;
+
+      // check first line to see if it is column names.  Should begin with a '#'
+      std::getline(fin,s);
+      if (s[0] == '#' || fTableType == kConditionsTable) {
         unsigned int ic=1;
 	if (fTableType == kConditionsTable && s[0] != '#') ic=0;
         int k;
@@ -1424,7 +2853,10 @@ namespace nutools {
 	return false;
       }
 
-      AddEmptyRows(nRow);
+      if (fColumnarStorage)
+        ioff = AddStoreRows(nRow);
+      else
+        AddEmptyRows(nRow);
       std::cout << "Added " << nRow << " empty rows" << std::endl;
 
       for (int jrow=0; jrow<nRow; ++jrow) {
@@ -1446,15 +2878,24 @@ namespace nutools {
           value = buff;
 
 	  if (j==chanIdx) {
-	    fRow[ioff+irow].SetChannel(strtoull(buff,NULL,10));
+	    if (fColumnarStorage)
+	      fStore.SetChannel(ioff+irow,strtoull(buff,NULL,10));
+	    else
+	      fRow[ioff+irow].SetChannel(strtoull(buff,NULL,10));
 	    ++joff;
 	  }
 	  else if (j==tvIdx) {
-	    fRow[ioff+irow].SetVldTime(strtoull(buff,NULL,10));
+	    if (fColumnarStorage)
+	      fStore.SetVldTime(ioff+irow,strtoull(buff,NULL,10));
+	    else
+	      fRow[ioff+irow].SetVldTime(strtoull(buff,NULL,10));
 	    ++joff;
 	  }
 	  else if (j==tvEndIdx) {
-	    fRow[ioff+irow].SetVldTimeEnd(strtoull(buff,NULL,10));
+	    if (fColumnarStorage)
+	      fStore.SetVldTimeEnd(ioff+irow,strtoull(buff,NULL,10));
+	    else
+	      fRow[ioff+irow].SetVldTimeEnd(strtoull(buff,NULL,10));
 	    ++joff;
 	  }
           else {
@@ -1503,11 +2944,19 @@ namespace nutools {
 		      (value[0] == '\'' && value[value.length()-1] == '\''))
 		    value = value.substr(1,value.length()-2);
 	    }
-	    fRow[ioff+irow].Col(colMap[j-joff]).FastSet(value);
+	    if (fColumnarStorage)
+	      fStore.SetFromString(ioff+irow,colMap[j-joff],value);
+	    else
+	      fRow[ioff+irow].Col(colMap[j-joff]).FastSet(value.c_str(),
+							   value.length(),
+							   fArena);
 	  } // else not a validity channel or time
 	}
 
-	fRow[ioff+irow].SetInDB();
+	if (fColumnarStorage)
+	  fStore.SetInDB(ioff+irow);
+	else
+	  fRow[ioff+irow].SetInDB();
         ++irow;
       }
       delete r;
@@ -1567,83 +3016,136 @@ namespace nutools {
 		<< result/1024 << " MB of PhysicalMemory" << std::endl;
     }
 
+    //************************************************************
+    size_t Table::MemoryUsage() const
+    {
+      size_t n = sizeof(Table);
+      n += fRow.capacity()*sizeof(Row);
+      for (unsigned int i=0; i<fRow.size(); ++i) n += fRow[i].HeapSize();
+      n += fStore.MemoryUsage();
+      n += fArena.Capacity();
+
+      n += fChanKey.capacity()*sizeof(uint64_t);
+      n += fChanOffset.capacity()*sizeof(unsigned int);
+      n += fChanRow.capacity()*sizeof(Row*);
+      n += fChanTime.capacity()*sizeof(double);
+      n += fChanMaxEnd.capacity()*sizeof(double);
+      n += fChanCursor.capacity()*sizeof(unsigned int);
+      n += fChanDense.capacity()*sizeof(int);
+
+      return n;
+    }
+
     //************************************************************
     
-    bool Table::GetDataFromWebService(Dataset& ds, std::string myss)
+    bool Table::GetDataFromWebService(Dataset& ds, std::string myss,
+                                      const std::string& cacheKey)
     {
-      Tuple tu;
       char ss[1024]; 
       char ss2[1024]; 
-      int wda_err, err;
+      int wda_err;
       std::vector<int> colMap(fCol.size());
       std::vector<bool> isString(fCol.size());
       std::vector<bool> isKnownField(fCol.size());
       
       const char* uagent = NULL;
 
-      if(fVerbosity > 0)
-	std::cout << "DBWeb query: " << myss << std::endl;
-      
+      // use the response to the same query from the local cache if
+      // there is one; those to tagged queries never go stale
+      std::string cacheFile;
+      std::string cached;
+      size_t cachePos = 0;
+      if (!cacheKey.empty() && !fWSCacheDir.empty()) {
+        std::ostringstream fname;
+        fname << fWSCacheDir << "/.dbi_ws_" << std::hex << HashSQL(cacheKey);
+        cacheFile = fname.str();
+        bool isTagged = (fTableType == kConditionsTable && fTag != "");
+        if (!fDisableCache && !fFlushCache)
+          cachePos = ReadWSCache(cacheFile,cacheKey,
+                                 (isTagged ? -1 : fWSCacheTTL),cached);
+      }
+      bool fromCache = (cachePos > 0);
+
       boost::posix_time::ptime ctt1;
       boost::posix_time::ptime ctt2;
-      
-      if (fTimeQueries) {
-	ctt1 = boost::posix_time::microsec_clock::local_time();
+
+      if (fromCache) {
+        if (fVerbosity > 0)
+          std::cout << "DBWeb query: " << myss << " (from " << cacheFile
+                    << ")" << std::endl;
       }
+      else {
+        if(fVerbosity > 0)
+	  std::cout << "DBWeb query: " << myss << std::endl;
       
-      ds = getDataWithTimeout(myss.c_str(), uagent, 
-			      fConnectionTimeout, &wda_err);
+        if (fTimeQueries) {
+	  ctt1 = boost::posix_time::microsec_clock::local_time();
+        }
       
-      if (fTimeQueries) {
-	ctt2 = boost::posix_time::microsec_clock::local_time();
-	boost::posix_time::time_duration tdiff = ctt2 - ctt1;
-	std::cerr << "Table::Load(" << Name() << "): query took " 
-		  << tdiff.total_milliseconds() << " ms" << std::endl;
-      }
+        ds = getDataWithTimeout(myss.c_str(), uagent, 
+				fConnectionTimeout, &wda_err);
+      
+        if (fTimeQueries) {
+	  ctt2 = boost::posix_time::microsec_clock::local_time();
+	  boost::posix_time::time_duration tdiff = ctt2 - ctt1;
+	  std::cerr << "Table::Load(" << Name() << "): query took " 
+		    << tdiff.total_milliseconds() << " ms" << std::endl;
+        }
 
-      int httpStatus = getHTTPstatus(ds);
+        int httpStatus = getHTTPstatus(ds);
 
-      if (httpStatus == 504) {
-        int nTry=0;
-        int sleepTime = 2;
-	time_t t0 = time(NULL);
-	time_t t1 = t0;
+        if (httpStatus == 504) {
+          int nTry=0;
+          int sleepTime = 2;
+	  time_t t0 = time(NULL);
+	  time_t t1 = t0;
 
-        while (httpStatus == 504 && ((t1-t0) < fConnectionTimeout) ) { 
-          sleepTime = 1 + ((double)random()/(double)RAND_MAX)*(1 << nTry++);
+          while (httpStatus == 504 && ((t1-t0) < fConnectionTimeout) ) { 
+            sleepTime = 1 + ((double)random()/(double)RAND_MAX)*(1 << nTry++);
 
-          std::cerr << "Table::Load() for " << Name() 
-		    << " failed with error 504, retrying in " << sleepTime 
-		    << " seconds." << std::endl;
+            std::cerr << "Table::Load() for " << Name() 
+		      << " failed with error 504, retrying in " << sleepTime 
+		      << " seconds." << std::endl;
 	  
-          sleep(sleepTime);
-	  t1 = time(NULL);
-	  if (fTimeQueries) 
-	    ctt1 = boost::posix_time::microsec_clock::local_time();
+            sleep(sleepTime);
+	    t1 = time(NULL);
+	    if (fTimeQueries) 
+	      ctt1 = boost::posix_time::microsec_clock::local_time();
 	  
-	  ds = getDataWithTimeout(myss.c_str(), uagent,
-				  fConnectionTimeout, &wda_err);
+	    ds = getDataWithTimeout(myss.c_str(), uagent,
+				    fConnectionTimeout, &wda_err);
 	  
-	  if (fTimeQueries) {
-	    ctt2 = boost::posix_time::microsec_clock::local_time();
-	    boost::posix_time::time_duration tdiff = ctt2 - ctt1;
-	    std::cerr << "Table::Load(" << Name() << "): query took " 
-		      << tdiff.total_milliseconds() << " ms" << std::endl;
-	  }
-	  httpStatus = getHTTPstatus(ds);
+	    if (fTimeQueries) {
+	      ctt2 = boost::posix_time::microsec_clock::local_time();
+	      boost::posix_time::time_duration tdiff = ctt2 - ctt1;
+	      std::cerr << "Table::Load(" << Name() << "): query took " 
+			<< tdiff.total_milliseconds() << " ms" << std::endl;
+	    }
+	    httpStatus = getHTTPstatus(ds);
+          }
         }
-      }
 
-      if (httpStatus != 200) {
-	std::cerr << "Table::Load: Web Service returned HTTP status " 
-		  << httpStatus << ": " << getHTTPmessage(ds) << std::endl;
-	return false;
+        if (httpStatus != 200) {
+	  std::cerr << "Table::Load: Web Service returned HTTP status " 
+		    << httpStatus << ": " << getHTTPmessage(ds) << std::endl;
+	  return false;
+        }
       }
 
       if (fTimeParsing)
 	ctt1 = boost::posix_time::microsec_clock::local_time();
 
-      int ntup = getNtuples(ds);
+      WSTuples tuples = (fromCache ? WSTuples(&cached,cachePos) :
+                         WSTuples(ds));
+
+      // keep a copy of what we got for next time
+      std::string record;
+      if (!fromCache && !cacheFile.empty() && !fDisableCache) {
+        record = std::string(kWSCacheMagic) + "\n" + cacheKey + "\n";
+        tuples.Record(&record);
+      }
+
+      int ntup = tuples.NTuples();
 
       // Getting no rows back can be legitimate
       if(ntup == 0){
@@ -1651,6 +3153,11 @@ namespace nutools {
 	  std::cout << "Got zero rows from database. Is that expected?" << std::endl;
 
 	fRow.clear();
+	fStore.Clear();
+	fNRowViews = 0;
+	fArena.Clear();
+
+	if (!record.empty()) WriteAtomically(cacheFile,record);
 
 	return true;
       }
@@ -1658,17 +3165,24 @@ namespace nutools {
       if(fVerbosity > 0)
 	std::cout << "Got " << ntup-1 << " rows from database" << std::endl;
 
-      int ioff=fRow.size();
-
-      AddEmptyRows(ntup);
+      int ioff;
+      if (fColumnarStorage)
+	ioff = AddStoreRows(ntup);
+      else {
+	ioff = fRow.size();
+	AddEmptyRows(ntup);
+      }
 
-      tu = getFirstTuple(ds);
-      if (tu == NULL) {
+      if (!tuples.Next()) {
 	std::cerr << "Table::Load(" << Name() << ") has NULL first tuple!"
 		  << std::endl;
 	return false;
       }
-      int ncol2 = getNfields(tu);
+      int ncol2 = tuples.NFields();
+      // the maps are indexed by field, which includes channel, tv, etc.
+      colMap.resize(ncol2,-1);
+      isString.resize(ncol2,false);
+      isKnownField.resize(ncol2,false);
       std::string chanStr = "channel";
       std::string tvStr = "tv";
       std::string tvEndStr = "tvend";
@@ -1676,7 +3190,7 @@ namespace nutools {
       int tvIdx=-1;
       int tvEndIdx=-1;
       for (int i=0; i<ncol2; ++i) {
-	getStringValue(tu,i,ss,sizeof(ss),&err);
+	tuples.Get(i,ss,sizeof(ss));
 	if (chanStr == ss)  { chanIdx=i;  continue;}
 	if (tvStr == ss)    { tvIdx=i;    continue;}
 	if (tvEndStr == ss) { tvEndIdx=i; continue;}
@@ -1699,24 +3213,31 @@ namespace nutools {
 	  isKnownField[i] = true;	  
       }
       
-      releaseTuple(tu);
-      tu = getNextTuple(ds);
       int irow=0;
-      while (tu != NULL) {
+      while (tuples.Next()) {
 	for (int i=0; i<ncol2; ++i) {	  
-	  getStringValue(tu,i,ss,sizeof(ss),&err);
+	  tuples.Get(i,ss,sizeof(ss));
 	  if (i == chanIdx) {
 	    uint64_t chan = strtoull(ss,NULL,10);
-	    fRow[ioff+irow].SetChannel(chan);
+	    if (fColumnarStorage)
+	      fStore.SetChannel(ioff+irow,chan);
+	    else
+	      fRow[ioff+irow].SetChannel(chan);
 	    continue;
 	  }
 	  else if (i == tvIdx) {
 	    double t1 = strtod(ss,NULL);
-	    fRow[ioff+irow].SetVldTime(t1);
+	    if (fColumnarStorage)
+	      fStore.SetVldTime(ioff+irow,t1);
+	    else
+	      fRow[ioff+irow].SetVldTime(t1);
 	  }
 	  else if (i == tvEndIdx) {
 	    double t1 = strtod(ss,NULL);
-	    fRow[ioff+irow].SetVldTimeEnd(t1);	    
+	    if (fColumnarStorage)
+	      fStore.SetVldTimeEnd(ioff+irow,t1);
+	    else
+	      fRow[ioff+irow].SetVldTimeEnd(t1);	    
 	  }
 	  else {
 	    if (isKnownField[i]) {
@@ -1724,15 +3245,20 @@ namespace nutools {
 		int k = strlen(ss);
 		strncpy(ss2,&ss[1],k-2);
 		ss2[k-2] = '\0';
-		fRow[ioff+irow].Col(colMap[i]).FastSet(ss2);
+		if (fColumnarStorage)
+		  fStore.SetFromString(ioff+irow,colMap[i],ss2,k-2);
+		else
+		  fRow[ioff+irow].Col(colMap[i]).FastSet(ss2,k-2,fArena);
+	      }
+	      else {
+		if (fColumnarStorage)
+		  fStore.SetFromString(ioff+irow,colMap[i],ss,strlen(ss));
+		else
+		  fRow[ioff+irow].Col(colMap[i]).FastSet(ss,strlen(ss),fArena);
 	      }
-	      else
-		fRow[ioff+irow].Col(colMap[i]).FastSet(ss);
 	    }
 	  }
 	}
-	releaseTuple(tu);
-	tu = getNextTuple(ds);
 	++irow;
       };
 
@@ -1746,9 +3272,16 @@ namespace nutools {
       // Make sure that the rows list is no longer than what we actually
       // filled. This happens because ntup above included the header row that
       // gives the column names.
-      while(int(fRow.size()) > irow) fRow.pop_back();
+      if (fColumnarStorage)
+	fStore.Resize(ioff+irow);
+      else
+	while(int(fRow.size()) > ioff+irow) fRow.pop_back();
+
+      // a response that ran out early is not worth keeping
+      if (!record.empty() && irow+1 == ntup)
+        WriteAtomically(cacheFile,record);
 	
-      releaseDataset(ds);
+      if (!fromCache) releaseDataset(ds);
 
       return true;
     }
@@ -1832,6 +3365,9 @@ namespace nutools {
       if (fSelectLimit>0)
 	myss << "&l=" << fSelectLimit;
 
+      // the local cache does not care what the server does with its own
+      std::string cacheKey = myss.str();
+
       if (fDisableCache) {
 	if (fFlushCache)
 	  myss << "&x=clear";
@@ -1839,236 +3375,962 @@ namespace nutools {
 	  myss << "&x=no";
       }
 
-      Dataset ds;
+      Dataset ds;
+
+      return GetDataFromWebService(ds,myss.str(),cacheKey);
+
+    }
+
+    //************************************************************
+
+    bool Table::LoadUnstructuredConditionsTable()
+    {
+      if (fMinTSVld == 0 || fMaxTSVld == 0) {
+        std::cerr << "Table::LoadUnstructuredConditionsTable: No validity time is set!" << std::endl;
+        return false;
+      }
+
+      if (fUConDBURL == "") {
+        std::cerr << "Table::LoadConditionsTable: Web Service URL is not set!" << std::endl;
+        return false;
+      }
+
+      if (!Util::RunningOnGrid()) {
+	std::string interactiveURL = getenv("DBIUCONDBURLINT");
+	if (!interactiveURL.empty())
+	  fUConDBURL = interactiveURL;
+      }
+
+      //      int ncol = this->NCol();
+
+      std::stringstream myss;
+
+      myss << fUConDBURL << "get?folder=" << Folder() << "." << Name() << "&";
+
+      
+      return false;
+    }
+    
+    //************************************************************
+
+    bool Table::LoadConditionsTable()
+    {
+      if (fDataTypeMask == 0) {
+        std::cerr << "Table::LoadConditionsTable: Data type mask is not set!" << std::endl;
+        return false;
+      }
+
+      if (fMinTSVld == 0 || fMaxTSVld == 0) {
+        std::cerr << "Table::LoadConditionsTable: No validity time is set!" << std::endl;
+        return false;
+      }
+
+      if (fWSURL == "") {
+        std::cerr << "Table::LoadConditionsTable: Web Service URL is not set!" << std::endl;
+        return false;
+      }
+
+      if (!Util::RunningOnGrid()) {
+	std::string interactiveURL = getenv("DBIWSURLINT");
+	if (!interactiveURL.empty())
+	  fWSURL = interactiveURL;
+      }
+
+      int ncol = this->NCol();
+
+      std::stringstream myss;
+
+      myss << fWSURL << "get?table=" << Schema() << "." << Name() << "&";
+
+      if (fDataTypeMask > kNone) {
+	myss << "type=";
+	
+	if ((fDataTypeMask & kMCOnly)) myss << "mc";
+	if ((fDataTypeMask & kDataOnly)) myss << "data";
+      
+	myss << "&";
+      }
+      
+      if (fMaxChannel > fMinChannel) {
+	myss << "cr=" << fMinChannel << "-" << fMaxChannel << "&";
+      }
+
+      if (fValiditySQL != "") {
+	myss << "where=" << fValiditySQL << "&";
+      }
+
+      if (fTag != "") myss << "tag=" << fTag << "&";
+
+      //      char ts[256];
+      
+      if (fMinTSVld == fMaxTSVld) {
+	//	sprintf(ts,"t=%" PRIu64,fMinTSVld);
+	//        myss << ts; //"t=" << fMinTSVld;
+        myss << "t=" << std::setprecision(12) << fMinTSVld;
+      }
+      else {
+	//	sprintf(ts,"t0=%" PRIu64 "&t1=" PRIu64,fMinTSVld,fMaxTSVld);
+	//        myss << ts; //"t0=" << fMinTSVld << "&t1=" << fMaxTSVld;
+        myss << "t0=" << std::setprecision(12) << fMinTSVld << "&t1=" << std::setprecision(12) << fMaxTSVld;
+      }
+
+      if (fHasRecordTime) myss << "&rtime=" << fRecordTime;
+
+      // the local cache does not care what the server does with its own
+      std::string cacheOpt;
+      if (fFlushCache) cacheOpt += "&cache=flush";
+      if (fDisableCache) cacheOpt += "&cache=no";
+
+      std::string head = myss.str();
+      myss.str("");
+
+      myss << "&columns=";
+      bool firstCol = true;
+      for (int i=0; i<ncol; ++i) {
+        std::string cName = this->GetCol(i)->Name();
+	bool skipCol = false;
+	for (size_t j=0; j<fExcludeCol.size(); ++j) 
+	  if (fExcludeCol[j] == cName) {
+	    skipCol = true;
+	    break;
+	  }
+	if (skipCol) continue;
+	if(!firstCol) myss << ",";
+        myss << this->GetCol(i)->Name();
+	firstCol = false;
+      }
+
+      //      std::cout << myss.str() << std::endl;
+      Dataset ds;
+      
+      return GetDataFromWebService(ds,head+cacheOpt+myss.str(),
+                                   head+myss.str());
+
+    }
+
+    //************************************************************
+
+    bool Table::Load()
+    {      
+      if (Util::RunningOnGrid()) {
+	fConnectionTimeout = 1800;
+      }
+      if (fTableType==kConditionsTable) 
+	return LoadConditionsTable();
+      else if (fTableType==kUnstructuredConditionsTable) 
+	return LoadUnstructuredConditionsTable();
+      else
+	return LoadNonConditionsTable();
+    }
+
+    //************************************************************
+    // Create a look-up table of time-ordered validity rows based on
+    // channel number.  This is one sort of (channel, time, row) keys,
+    // rather than an insertion per row, and the result is kept in
+    // flat arrays instead of a vector per channel.  Rows with equal
+    // validity times keep their order.  If any row has a validity end
+    // time, each channel also gets an interval tree of the end times.
+    // A table served from a snapshot takes over the index saved with
+    // it instead, without sorting.
+    //************************************************************
+
+    void Table::FillChanRowMap()
+    {
+      FillRowViews();
+      ClearChanRowMap();
+
+      // a mapped snapshot brings its index with it
+      if (!TakeSnapshotIndex()) BuildChanRowMap();
+      fSnapIndex.clear();
+      fSnapMapping.reset();
+
+      if (fVldCursor) fChanCursor.assign(fChanKey.size(),0);
+
+      // channel numbers that are (nearly) dense index an array directly
+      if (!fChanKey.empty() &&
+          fChanKey.back() - fChanKey.front() < 4*uint64_t(fChanKey.size())) {
+        fChanDense.assign(fChanKey.back() - fChanKey.front() + 1,-1);
+        for (unsigned int k=0; k<fChanKey.size(); ++k)
+          fChanDense[fChanKey[k] - fChanKey.front()] = k;
+      }
+    }
+
+    //************************************************************
+    void Table::BuildChanRowMap()
+    {
+      std::vector<unsigned int> row;
+      MakeChanIndex(fRow.size(),
+                    [this](unsigned int i, uint64_t& chan, double& tv,
+                           double& end) {
+                      chan = fRow[i].Channel();
+                      tv = fRow[i].VldTime();
+                      end = VldTimeEnd(fRow[i]);
+                    },
+                    fChanKey,fChanOffset,row,fChanTime,fChanMaxEnd);
+      fChanRow.resize(row.size());
+      for (unsigned int i=0; i<row.size(); ++i) fChanRow[i] = &fRow[row[i]];
+    }
+
+    //************************************************************
+    // Take over the index that MapSnapshot() found in the file, if the
+    // rows are still those of the file and the index is the one that
+    // BuildChanRowMap() would make of them; this is O(n), with no sort.
+    // The interval trees are taken as they are.
+    //************************************************************
+    bool Table::TakeSnapshotIndex()
+    {
+      if (fSnapIndex.size() != 5) return false;
+
+      size_t nrow = fRow.size();
+      size_t nchan = fSnapIndex[0].second/sizeof(uint64_t);
+      if (nchan == 0 || nrow != fStore.NRow() ||
+          fSnapIndex[1].second != (nchan+1)*sizeof(uint32_t) ||
+          fSnapIndex[2].second != nrow*sizeof(uint32_t) ||
+          fSnapIndex[3].second != nrow*sizeof(double) ||
+          (fSnapIndex[4].second != 0 &&
+           fSnapIndex[4].second != (2*nrow-nchan)*sizeof(double)))
+        return false;
+
+      const uint64_t* key = (const uint64_t*)fSnapIndex[0].first;
+      const uint32_t* off = (const uint32_t*)fSnapIndex[1].first;
+      const uint32_t* row = (const uint32_t*)fSnapIndex[2].first;
+      const double*   tv  = (const double*)fSnapIndex[3].first;
+
+      if (off[0] != 0 || off[nchan] != nrow) return false;
+      std::vector<bool> seen(nrow,false);
+      for (size_t k=0; k<nchan; ++k) {
+        if (off[k+1] <= off[k] || (k > 0 && key[k] <= key[k-1]))
+          return false;
+        for (size_t i=off[k]; i<off[k+1]; ++i) {
+          if (row[i] >= nrow || seen[row[i]]) return false;
+          seen[row[i]] = true;
+          const Row& r = fRow[row[i]];
+          if (r.Channel() != key[k] || r.VldTime() != tv[i]) return false;
+          if (i > off[k] && (tv[i] < tv[i-1] ||
+                             (tv[i] == tv[i-1] && row[i] < row[i-1])))
+            return false;
+        }
+      }
+
+      fChanKey.assign(key,key+nchan);
+      fChanOffset.assign(off,off+nchan+1);
+      fChanRow.resize(nrow);
+      for (size_t i=0; i<nrow; ++i) fChanRow[i] = &fRow[row[i]];
+      fChanTime.assign(tv,tv+nrow);
+      const double* maxEnd = (const double*)fSnapIndex[4].first;
+      fChanMaxEnd.assign(maxEnd,maxEnd + fSnapIndex[4].second/sizeof(double));
+      return true;
+    }
+
+    //************************************************************
+
+    std::shared_ptr<const FrozenTable> Table::Freeze(std::unique_ptr<Table> t)
+    {
+      if (!t) return std::shared_ptr<const FrozenTable>();
+
+      // fill in everything the const interface needs now, while the
+      // table is still ours alone
+      if (t->fTableType == kConditionsTable ||
+          t->fTableType == kUnstructuredConditionsTable)
+        t->FillChanRowMap();
+      else
+        t->FillRowViews();
+      t->DisableVldCursor();
+      if (t->fHasConnection) t->CloseConnection();
+
+      // comparing columns caches their keys, which would make readers
+      // that compare the same cells write to them at once
+      for (unsigned int i=0; i<t->fRow.size(); ++i)
+        for (int j=0; j<t->fRow[i].NCol(); ++j)
+          t->fRow[i].Col(j).FillKeyNow();
+
+      return std::shared_ptr<const FrozenTable>(new FrozenTable(std::move(t)));
+    }
+
+    //************************************************************
+    // Index of channel in fChanKey, or -1
+    //************************************************************
+    int Table::ChanIndex(uint64_t channel) const
+    {
+      if (!fChanDense.empty()) {
+        uint64_t i = channel - fChanKey.front();  // wraps if below
+        return (i < fChanDense.size() ? fChanDense[i] : -1);
+      }
+      std::vector<uint64_t>::const_iterator itr =
+        std::lower_bound(fChanKey.begin(),fChanKey.end(),channel);
+      if (itr == fChanKey.end() || *itr != channel) return -1;
+      return (itr - fChanKey.begin());
+    }
+
+    //************************************************************
+
+    int Table::NVldRows(uint64_t channel) const
+    {
+      int k = ChanIndex(channel);
+      if (k < 0) return 0;
+      return (fChanOffset[k+1] - fChanOffset[k]);
+    }
+
+    //************************************************************
+
+    Span<nutools::dbi::Row*> Table::GetVldRows(uint64_t channel)
+    {
+      int k = ChanIndex(channel);
+      if (k < 0) return Span<nutools::dbi::Row*>();
+      return Span<nutools::dbi::Row*>(&fChanRow[fChanOffset[k]],
+                                      fChanOffset[k+1] - fChanOffset[k]);
+    }
+
+    //************************************************************
+
+    Span<const nutools::dbi::Row*> Table::GetVldRows(uint64_t channel) const
+    {
+      // a Row* can always be read as a const Row*
+      Span<nutools::dbi::Row*> rows =
+        const_cast<Table*>(this)->GetVldRows(channel);
+      return Span<const nutools::dbi::Row*>(
+        reinterpret_cast<const nutools::dbi::Row* const*>(rows.data()),
+        rows.size());
+    }
+
+    //************************************************************
+
+    nutools::dbi::Row* Table::GetVldRow(uint64_t channel, double t) 
+    {      
+      const Table* ct = this;
+      return const_cast<nutools::dbi::Row*>(ct->GetVldRow(channel,t));
+    }
+
+    //************************************************************
+
+    const nutools::dbi::Row* Table::GetVldRow(uint64_t channel,
+                                              double t) const
+    {
+      int k = ChanIndex(channel);
+      if (k < 0) return 0;
+
+      // the rows of a channel are time-ordered, and their times are kept
+      // side by side, so the search does not have to touch the rows
+      unsigned int off = fChanOffset[k];
+      unsigned int n = fChanOffset[k+1] - off;
+      const double* t0 = &fChanTime[off];
+      if (!(t >= *t0)) return 0;  // before the first row, or NaN
+
+      unsigned int p;
+      unsigned int c = (fVldCursor ? fChanCursor[k] : n);
+      if (c < n && t >= t0[c]) {
+        // times mostly go forwards, so start from the row found last
+        // time for this channel: that one, or the next, is O(1)
+        p = GallopUpper(t0+c,t0+n,t) - t0 - 1;
+      }
+      else
+        p = std::upper_bound(t0,t0+n,t) - t0 - 1;
+      if (fVldCursor) fChanCursor[k] = p;
+
+      return VldRowAt(k,p,t);
+    }
+
+    //************************************************************
+
+    void Table::EnableVldCursor()
+    {
+      fVldCursor = true;
+      fChanCursor.assign(fChanKey.size(),0);
+    }
+
+    //************************************************************
+
+    void Table::DisableVldCursor()
+    {
+      fVldCursor = false;
+      std::vector<unsigned int>().swap(fChanCursor);
+    }
+
+    //************************************************************
+    // The row of fChanKey[k] valid at t, given that its p-th is the
+    // last one to start at or before t
+    //************************************************************
+    const nutools::dbi::Row* Table::VldRowAt(int k, unsigned int p,
+                                             double t) const
+    {
+      // usually the last row to start is still valid; if it is not, an
+      // earlier one may be
+      unsigned int off = fChanOffset[k];
+      const nutools::dbi::Row* r = fChanRow[off+p];
+      if (fChanMaxEnd.empty() || t < VldTimeEnd(*r)) return r;
+      int i = LastEndingAfter(&fChanMaxEnd[2*off-k],0,0,
+                              fChanOffset[k+1]-off-1,p,t);
+      if (i < 0) return 0;
+      return fChanRow[off+i];
+    }
+
+    //************************************************************
+    // Batch look-up.  The hits are put in order of channel and time,
+    // unless they already are in order of channel, so that a single
+    // pass walks the channel keys and the validity times of each
+    // channel forwards, galloping over the parts that no hit needs.
+    // In parallel, each chunk of the ordered hits does its own walk.
+    //************************************************************
+    void Table::GetVldRowBatch(Span<uint64_t> channel, Span<double> t,
+                               std::vector<const nutools::dbi::Row*>& rows,
+                               bool parallel) const
+    {
+      size_t n = std::min(channel.size(),t.size());
+      rows.assign(n,0);
+      if (n == 0 || fChanKey.empty()) return;
+
+      struct Hit {
+        uint64_t chan;
+        double   t;
+        size_t   i;
+        bool operator<(const Hit& h) const {
+          if (chan != h.chan) return (chan < h.chan);
+          return (t < h.t);
+        }
+      };
+
+      // walks hits [b,e) of those in order, hitAt(j) being the j-th
+      auto walk = [&](auto hitAt, size_t b, size_t e) {
+        const uint64_t* ck = fChanKey.data();
+        const uint64_t* ckEnd = ck + fChanKey.size();
+        const uint64_t* c = ck;
+        size_t j = b;
+        while (j < e) {
+          uint64_t ch = hitAt(j).chan;
+          c = GallopLower(c,ckEnd,ch);
+          if (c == ckEnd) break;
+          if (*c != ch) {
+            while (j < e && hitAt(j).chan == ch) ++j;
+            continue;
+          }
+          int k = c - ck;
+          const double* t0 = &fChanTime[fChanOffset[k]];
+          const double* t1 = &fChanTime[0] + fChanOffset[k+1];
+          const double* tp = t0;
+          for (; j < e; ++j) {
+            Hit h = hitAt(j);
+            if (h.chan != ch) break;
+            if (!(h.t >= *t0)) continue;  // also NaN
+            if (tp != t0 && h.t < tp[-1]) tp = t0;  // time went back
+            tp = GallopUpper(tp,t1,h.t);
+            rows[h.i] = VldRowAt(k,tp-t0-1,h.t);
+          }
+        }
+      };
+      auto walkAll = [&](auto hitAt, size_t nhit) {
+        if (parallel)
+          tbb::parallel_for(tbb::blocked_range<size_t>(0,nhit,4096),
+                            [&](const tbb::blocked_range<size_t>& r) {
+                              walk(hitAt,r.begin(),r.end());
+                            });
+        else
+          walk(hitAt,0,nhit);
+      };
+
+      // hits that come in order of channel (as from the DAQ) are used
+      // in place
+      size_t i = 1;
+      while (i < n && channel[i-1] <= channel[i]) ++i;
+      if (i == n) {
+        walkAll([&](size_t j) { return Hit{channel[j],t[j],j}; },n);
+        return;
+      }
+
+      // NaN times find nothing, and would break the ordering
+      std::vector<Hit> hit;
+      hit.reserve(n);
+      for (i=0; i<n; ++i)
+        if (!std::isnan(t[i])) hit.push_back(Hit{channel[i],t[i],i});
+      if (parallel)
+        tbb::parallel_sort(hit.begin(),hit.end());
+      else
+        std::sort(hit.begin(),hit.end());
+      walkAll([&](size_t j) { return hit[j]; },hit.size());
+    }
+
+    //************************************************************
+    // Rows of fChanKey[k] that start at or before tv and end after
+    // tvend, in order of validity time
+    //************************************************************
+    void Table::FindVldRows(int k, double tv, double tvend,
+                            std::vector<const nutools::dbi::Row*>& rows) const
+    {
+      rows.clear();
+      if (k < 0) return;
+
+      unsigned int off = fChanOffset[k];
+      unsigned int n = fChanOffset[k+1] - off;
+      const double* t0 = &fChanTime[off];
+      if (!(tv >= *t0) || std::isnan(tvend)) return;
+      unsigned int p = std::upper_bound(t0,t0+n,tv) - t0 - 1;
+
+      if (fChanMaxEnd.empty()) {
+        // each row ends where the next one starts, so only those from
+        // the last to start at or before tvend on can end after it
+        unsigned int i = std::upper_bound(t0,t0+n,tvend) - t0;
+        for (i = (i > 0 ? i-1 : 0); i <= p; ++i) {
+          if (i+1 == n) {
+            if (tvend < std::numeric_limits<double>::infinity())
+              rows.push_back(fChanRow[off+i]);
+          }
+          else if (t0[i+1] > t0[i] && t0[i+1] > tvend)
+            rows.push_back(fChanRow[off+i]);
+        }
+      }
+      else
+        AllEndingAfter(&fChanMaxEnd[2*off-k],0,0,n-1,p,tvend,
+                       &fChanRow[off],rows);
+    }
+
+    //************************************************************
+
+    void Table::GetVldRows(uint64_t channel, double t0, double t1,
+                           std::vector<const nutools::dbi::Row*>& rows) const
+    {
+      if (!(t0 <= t1)) { rows.clear(); return; }
+      FindVldRows(ChanIndex(channel),t1,t0,rows);
+    }
+
+    //************************************************************
+
+    void Table::GetVldRowsCovering(uint64_t channel, double t0, double t1,
+                                   std::vector<const nutools::dbi::Row*>& rows) const
+    {
+      if (!(t0 <= t1)) { rows.clear(); return; }
+      FindVldRows(ChanIndex(channel),t0,t1,rows);
+    }
+
+    //************************************************************
+    bool Table::Tag(std::string tn, bool override)
+    {
+      if (tn != "") fTag = tn;
+
+      if (fTag == "") return false;
+
+      std::stringstream myss;
+
+      myss << fWSURL << "tag?table=" << Schema() << "." << Name() << "&";
+      myss << "tag=" << fTag;
+      if (override)
+	myss << "&override=yes";
+
+      int status;
+      std::string pwd = GetPassword();
 
-      return GetDataFromWebService(ds,myss.str());
+      postHTTPsigned(myss.str().c_str(), pwd.c_str(), NULL, 0, NULL, 0, &status);
 
+      return (status==0);
     }
 
     //************************************************************
-
-    bool Table::LoadUnstructuredConditionsTable()
+    // The columns set by an INSERT, ie. all but the autoincr and
+    // update ones
+    //************************************************************
+    void Table::AddInsertColumns(std::ostream& outs)
     {
-      if (fMinTSVld == 0 || fMaxTSVld == 0) {
-        std::cerr << "Table::LoadUnstructuredConditionsTable: No validity time is set!" << std::endl;
-        return false;
-      }
-
-      if (fUConDBURL == "") {
-        std::cerr << "Table::LoadConditionsTable: Web Service URL is not set!" << std::endl;
-        return false;
+      bool first = true;
+      outs << "(";
+      for (unsigned int j=0; j<fCol.size(); ++j) {
+        if (fCol[j].Name() == "updatetime") continue;
+        if (fCol[j].Name() == "updateuser") continue;
+        if (fCol[j].Type() == "autoincr") continue;
+
+        if (!first) outs << ",";
+        outs << fCol[j].Name();
+        first = false;
       }
+      outs << ")";
+    }
 
-      if (!Util::RunningOnGrid()) {
-	std::string interactiveURL = getenv("DBIUCONDBURLINT");
-	if (!interactiveURL.empty())
-	  fUConDBURL = interactiveURL;
+    //************************************************************
+    void Table::AddInsertValues(std::ostream& outs, const Row& r)
+    {
+      bool first = true;
+      outs << "(";
+      for (unsigned int j=0; j<fCol.size(); ++j) {
+        if (fCol[j].Name() == "updatetime") continue;
+        if (fCol[j].Name() == "updateuser") continue;
+        if (fCol[j].Type() == "autoincr") continue;
+
+        if (!first) outs << ",";
+        outs << r.Col(j);
+        first = false;
       }
+      outs << ")";
+    }
 
-      //      int ncol = this->NCol();
-
-      std::stringstream myss;
+    //************************************************************
+    std::string Table::MakeInsertSQL(const Row& r)
+    {
+      std::ostringstream outs;
 
-      myss << fUConDBURL << "get?folder=" << Folder() << "." << Name() << "&";
+      outs << "INSERT INTO " << Schema() << "." << Name() << " ";
+      AddInsertColumns(outs);
+      outs << " VALUES ";
+      AddInsertValues(outs,r);
 
-      
-      return false;
+      return outs.str();
     }
-    
-    //************************************************************
 
-    bool Table::LoadConditionsTable()
+    //************************************************************
+    // Insert the rows that are not yet in the dB fInsertBatchSize at a
+    // time, reading back the autoincr values with RETURNING.  Each
+    // batch runs under a SAVEPOINT; rows of a batch that fails, and all
+    // rows after it if the SAVEPOINT itself fails, are left alone for
+    // WriteToDB() to insert one by one.
+    //************************************************************
+    bool Table::BatchInsertToDB(const std::string& ts)
     {
-      if (fDataTypeMask == 0) {
-        std::cerr << "Table::LoadConditionsTable: Data type mask is not set!" << std::endl;
-        return false;
-      }
-
-      if (fMinTSVld == 0 || fMaxTSVld == 0) {
-        std::cerr << "Table::LoadConditionsTable: No validity time is set!" << std::endl;
-        return false;
-      }
+      std::vector<unsigned int> irow;
+      for (unsigned int i=0; i<fRow.size(); ++i)
+        if (! fRow[i].InDB()) irow.push_back(i);
+      if (irow.empty()) return true;
 
-      if (fWSURL == "") {
-        std::cerr << "Table::LoadConditionsTable: Web Service URL is not set!" << std::endl;
-        return false;
-      }
+      std::vector<int> seqCol;
+      for (unsigned int j=0; j<fCol.size(); ++j)
+        if (fCol[j].Type() == "autoincr") seqCol.push_back(j);
 
-      if (!Util::RunningOnGrid()) {
-	std::string interactiveURL = getenv("DBIWSURLINT");
-	if (!interactiveURL.empty())
-	  fWSURL = interactiveURL;
-      }
+      std::map<std::string,int> colMap = GetColNameToIndexMap();
+      int insertTimeIdx = colMap["inserttime"];
+      int insertUserIdx = colMap["insertuser"];
 
-      int ncol = this->NCol();
+      std::ostringstream head;
+      head << "INSERT INTO " << Schema() << "." << Name() << " ";
+      AddInsertColumns(head);
+      head << " VALUES ";
 
-      std::stringstream myss;
+      std::ostringstream tail;
+      for (unsigned int k=0; k<seqCol.size(); ++k)
+        tail << (k == 0 ? " RETURNING " : ",") << fCol[seqCol[k]].Name();
 
-      myss << fWSURL << "get?table=" << Schema() << "." << Name() << "&";
+      bool retVal = true;
+      unsigned int nbatch = fInsertBatchSize;
 
-      if (fDataTypeMask > kNone) {
-	myss << "type=";
-	
-	if ((fDataTypeMask & kMCOnly)) myss << "mc";
-	if ((fDataTypeMask & kDataOnly)) myss << "data";
-      
-	myss << "&";
-      }
-      
-      if (fMaxChannel > fMinChannel) {
-	myss << "cr=" << fMinChannel << "-" << fMaxChannel << "&";
-      }
+      for (unsigned int i0=0; i0<irow.size(); i0 += nbatch) {
+        unsigned int i1 = std::min(i0+nbatch,(unsigned int)irow.size());
 
-      if (fValiditySQL != "") {
-	myss << "where=" << fValiditySQL << "&";
-      }
+        std::ostringstream outs;
+        outs << head.str();
+        for (unsigned int i=i0; i<i1; ++i) {
+          Row r(fRow[irow[i]]);
+          if (addInsertTime) r.Set(insertTimeIdx,ts);
+          if (addInsertUser) r.Set(insertUserIdx,fUser);
+          if (i > i0) outs << ",";
+          AddInsertValues(outs,r);
+        }
+        outs << tail.str();
 
-      if (fTag != "") myss << "tag=" << fTag << "&";
+        if (fVerbosity > 0)
+          std::cerr << "Table::WriteToDB: Executing PGSQL command: \n\t"
+                    << outs.str() << std::endl;
 
-      //      char ts[256];
-      
-      if (fMinTSVld == fMaxTSVld) {
-	//	sprintf(ts,"t=%" PRIu64,fMinTSVld);
-	//        myss << ts; //"t=" << fMinTSVld;
-        myss << "t=" << std::setprecision(12) << fMinTSVld;
-      }
-      else {
-	//	sprintf(ts,"t0=%" PRIu64 "&t1=" PRIu64,fMinTSVld,fMaxTSVld);
-	//        myss << ts; //"t0=" << fMinTSVld << "&t1=" << fMaxTSVld;
-        myss << "t0=" << std::setprecision(12) << fMinTSVld << "&t1=" << std::setprecision(12) << fMaxTSVld;
-      }
+        boost::posix_time::ptime ctt1;
+        boost::posix_time::ptime ctt2;
 
-      if (fHasRecordTime) myss << "&rtime=" << fRecordTime;
+        if (fTimeQueries)
+          ctt1 = boost::posix_time::microsec_clock::local_time();
 
-      if (fFlushCache) myss << "&cache=flush";
-      if (fDisableCache) myss << "&cache=no";
+        PGresult* res = PQexec(fConnection, "SAVEPOINT batch_insert");
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+          std::cerr << "SAVEPOINT failed: " << PQerrorMessage(fConnection)
+                    << std::endl;
+          PQclear(res);
+          return false;
+        }
+        PQclear(res);
 
-      myss << "&columns=";
-      bool firstCol = true;
-      for (int i=0; i<ncol; ++i) {
-        std::string cName = this->GetCol(i)->Name();
-	bool skipCol = false;
-	for (size_t j=0; j<fExcludeCol.size(); ++j) 
-	  if (fExcludeCol[j] == cName) {
-	    skipCol = true;
-	    break;
-	  }
-	if (skipCol) continue;
-	if(!firstCol) myss << ",";
-        myss << this->GetCol(i)->Name();
-	firstCol = false;
-      }
+        res = PQexec(fConnection, outs.str().c_str());
 
-      //      std::cout << myss.str() << std::endl;
-      Dataset ds;
-      
-      return GetDataFromWebService(ds,myss.str());
+        if (fTimeQueries) {
+          ctt2 = boost::posix_time::microsec_clock::local_time();
+          boost::posix_time::time_duration tdiff = ctt2 - ctt1;
+          std::cerr << "Table::WriteToDB(" << Name() << "): INSERT of "
+                    << i1-i0 << " rows took "
+                    << tdiff.total_milliseconds() << " ms" << std::endl;
+        }
 
-    }
+        ExecStatusType status = (seqCol.empty() ? PGRES_COMMAND_OK :
+                                 PGRES_TUPLES_OK);
+        bool isOk = (PQresultStatus(res) == status &&
+                     (seqCol.empty() || PQntuples(res) == int(i1-i0)));
+        if (!isOk)
+          std::cerr << "Batch INSERT failed, inserting rows one at a time: "
+                    << PQerrorMessage(fConnection) << std::endl;
+        else {
+          for (unsigned int i=i0; i<i1; ++i) {
+            Row& r = fRow[irow[i]];
+            r.SetInDB();
+            if (addInsertTime) r.Col(insertTimeIdx).Set(ts);
+            if (addInsertUser) r.Col(insertUserIdx).Set(fUser);
+            for (unsigned int k=0; k<seqCol.size(); ++k)
+              r.Col(seqCol[k]).Set(std::string(PQgetvalue(res,i-i0,k)),true);
+          }
+        }
+        PQclear(res);
 
-    //************************************************************
+        res = PQexec(fConnection, (isOk ? "RELEASE SAVEPOINT batch_insert" :
+                                   "ROLLBACK TO SAVEPOINT batch_insert"));
+        PQclear(res);
 
-    bool Table::Load()
-    {      
-      if (Util::RunningOnGrid()) {
-	fConnectionTimeout = 1800;
+        if (!isOk) retVal = false;
       }
-      if (fTableType==kConditionsTable) 
-	return LoadConditionsTable();
-      else if (fTableType==kUnstructuredConditionsTable) 
-	return LoadUnstructuredConditionsTable();
-      else
-	return LoadNonConditionsTable();
+
+      return retVal;
     }
 
     //************************************************************
-    // Create a look-up table of time-ordered validity rows based on
-    // channel number
+    // Insert all rows that are not yet in the dB with a single COPY.
+    // autoincr keys cannot be read back from a COPY, so they are taken
+    // from the column's sequence up front, with one query per column,
+    // and sent along with the rest of the row.  Must be called inside
+    // the transaction opened by WriteToDB().  On failure nothing is
+    // inserted and no row is touched.
     //************************************************************
-
-    void Table::FillChanRowMap()
+    bool Table::BulkInsertToDB(const std::string& ts)
     {
-      nutools::dbi::Row* row;
-      uint64_t chan;
-      double tv;
-      fChanRowMap.clear();
-
-      for (int i=0; i<this->NRow(); ++i) {
-        row = this->GetRow(i);
-	chan = row->Channel();
-	tv = row->VldTime();
-	if (fChanRowMap[chan].empty())
-	  fChanRowMap[chan].push_back(row);
-	else {
-	  bool wasInserted=false;
-	  for (unsigned int j=0; j<fChanRowMap[chan].size(); ++j) {
-	    if (tv < fChanRowMap[chan][j]->VldTime()) {
-	      fChanRowMap[chan].insert(fChanRowMap[chan].begin()+j,row);
-	      wasInserted=true;
-	      break;
-	    }
-	  }
-	  if (!wasInserted)
-	    fChanRowMap[chan].push_back(row);
-	}
+      std::vector<unsigned int> irow;
+      for (unsigned int i=0; i<fRow.size(); ++i)
+        if (! fRow[i].InDB()) irow.push_back(i);
+      if (irow.empty()) return true;
+
+      boost::posix_time::ptime ctt1;
+      boost::posix_time::ptime ctt2;
+
+      if (fTimeQueries)
+        ctt1 = boost::posix_time::microsec_clock::local_time();
+
+      PGresult* res = PQexec(fConnection, "SAVEPOINT bulk_insert");
+      if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        std::cerr << "SAVEPOINT failed: " << PQerrorMessage(fConnection)
+                  << std::endl;
+        PQclear(res);
+        return false;
       }
+      PQclear(res);
 
-      fChannelVec.clear();
-      std::unordered_map<uint64_t,std::vector<nutools::dbi::Row*> >::iterator itr = fChanRowMap.begin();
-      std::unordered_map<uint64_t,std::vector<nutools::dbi::Row*> >::iterator itrEnd = fChanRowMap.end();
+      bool isOk = true;
+      std::vector<int> insCol;
+      std::vector<int> seqCol;
+      std::vector<std::vector<std::string> > seqVal;
+      std::ostringstream outs;
 
-      for (; itr != itrEnd; ++itr) 
-        fChannelVec.push_back(itr->first);
+      // reserve the autoincr keys
+      for (unsigned int j=0; j<fCol.size() && isOk; ++j) {
+        if (fCol[j].Name() == "updatetime") continue;
+        if (fCol[j].Name() == "updateuser") continue;
+        insCol.push_back(j);
+        if (fCol[j].Type() != "autoincr") continue;
+
+        outs.str("");
+        outs << "SELECT nextval(pg_get_serial_sequence('" << Schema() << "."
+             << Name() << "','" << fCol[j].Name() << "')) "
+             << "FROM generate_series(1," << irow.size() << ")";
+        if (fVerbosity > 0)
+          std::cerr << "Table::WriteToDB: Executing PGSQL command: \n\t"
+                    << outs.str() << std::endl;
 
+        res = PQexec(fConnection, outs.str().c_str());
+        if (PQresultStatus(res) != PGRES_TUPLES_OK ||
+            PQntuples(res) != (int)irow.size()) {
+          std::cerr << "Reserving " << fCol[j].Name() << " values failed: "
+                    << PQerrorMessage(fConnection) << std::endl;
+          isOk = false;
+        }
+        else {
+          seqCol.push_back(j);
+          seqVal.push_back(std::vector<std::string>(irow.size()));
+          for (unsigned int i=0; i<irow.size(); ++i)
+            seqVal.back()[i] = PQgetvalue(res,i,0);
+        }
+        PQclear(res);
+      }
 
-    }
+      if (isOk) {
+        outs.str("");
+        outs << "COPY " << Schema() << "." << Name() << " (";
+        for (unsigned int k=0; k<insCol.size(); ++k) {
+          if (k > 0) outs << ",";
+          outs << fCol[insCol[k]].Name();
+        }
+        outs << ") FROM STDIN";
+        if (fVerbosity > 0)
+          std::cerr << "Table::WriteToDB: Executing PGSQL command: \n\t"
+                    << outs.str() << std::endl;
+
+        res = PQexec(fConnection, outs.str().c_str());
+        if (PQresultStatus(res) != PGRES_COPY_IN) {
+          std::cerr << "COPY failed: " << PQerrorMessage(fConnection)
+                    << std::endl;
+          isOk = false;
+        }
+        PQclear(res);
+      }
 
-    //************************************************************
+      if (isOk) {
+        const size_t kChunkSize = 1 << 16;
+        std::string buf;
+        buf.reserve(kChunkSize + 1024);
+
+        for (unsigned int i=0; i<irow.size() && isOk; ++i) {
+          const Row& r = fRow[irow[i]];
+          unsigned int iseq = 0;
+          for (unsigned int k=0; k<insCol.size(); ++k) {
+            int j = insCol[k];
+            if (k > 0) buf += '\t';
+            if (fCol[j].Type() == "autoincr")
+              buf += seqVal[iseq++][i];
+            else if (addInsertTime && fCol[j].Name() == "inserttime")
+              AppendCopyValue(buf,ts);
+            else if (addInsertUser && fCol[j].Name() == "insertuser")
+              AppendCopyValue(buf,fUser);
+            else if (r.Col(j).IsNull())
+              buf += "\\N";
+            else
+              AppendCopyValue(buf,r.Col(j).Value());
+          }
+          buf += '\n';
 
-    std::vector<nutools::dbi::Row*> Table::GetVldRows(uint64_t channel)
-    {
-      return fChanRowMap[channel];
-    }
+          if (buf.size() >= kChunkSize || i == irow.size()-1) {
+            if (PQputCopyData(fConnection,buf.data(),buf.size()) != 1)
+              isOk = false;
+            buf.clear();
+          }
+        }
 
-    //************************************************************
+        if (PQputCopyEnd(fConnection,(isOk ? NULL : "aborted")) != 1)
+          isOk = false;
 
-    nutools::dbi::Row* Table::GetVldRow(uint64_t channel, double t) 
-    {      
-      std::vector<nutools::dbi::Row*>& rlist = fChanRowMap[channel];
-      if (rlist.empty()) return 0;
-      int irow=-1;
-      double tv;
-      // fChanRowMap is time-ordered, so this simplifies things
-      unsigned int i=0;
-      for ( ; i<rlist.size(); ++i) {
-	tv = rlist[i]->VldTime();
-	if (t >= tv) irow=i;
-	else break;
+        while ((res = PQgetResult(fConnection)) != NULL) {
+          if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            if (isOk)
+              std::cerr << "COPY failed: " << PQerrorMessage(fConnection)
+                        << std::endl;
+            isOk = false;
+          }
+          PQclear(res);
+        }
+      }
+
+      res = PQexec(fConnection, (isOk ? "RELEASE SAVEPOINT bulk_insert" :
+                                 "ROLLBACK TO SAVEPOINT bulk_insert"));
+      PQclear(res);
+
+      if (fTimeQueries) {
+        ctt2 = boost::posix_time::microsec_clock::local_time();
+        boost::posix_time::time_duration tdiff = ctt2 - ctt1;
+        std::cerr << "Table::WriteToDB(" << Name() << "): COPY of "
+                  << irow.size() << " rows took "
+                  << tdiff.total_milliseconds() << " ms" << std::endl;
+      }
+
+      if (!isOk) {
+        std::cerr << "Table::WriteToDB: bulk insert failed, inserting rows "
+                  << "one at a time." << std::endl;
+        return false;
+      }
+
+      std::map<std::string,int> colMap = GetColNameToIndexMap();
+      int insertTimeIdx = colMap["inserttime"];
+      int insertUserIdx = colMap["insertuser"];
+      for (unsigned int i=0; i<irow.size(); ++i) {
+        Row& r = fRow[irow[i]];
+        r.SetInDB();
+        if (addInsertTime) r.Col(insertTimeIdx).Set(ts);
+        if (addInsertUser) r.Col(insertUserIdx).Set(fUser);
+        for (unsigned int k=0; k<seqCol.size(); ++k)
+          r.Col(seqCol[k]).Set(seqVal[k][i],true);
       }
-      if (irow>=0) return rlist[irow];
-      return 0;
+
+      return true;
     }
 
     //************************************************************
-    bool Table::Tag(std::string tn, bool override)
+    std::string Table::MakeUpdateSQL(Row& r)
     {
-      if (tn != "") fTag = tn;
+      std::ostringstream outs;
+      outs << "UPDATE " << Schema() << "." << Name() << " SET ";
+      int im = 0;
+      for (unsigned int j=0; j<fCol.size() && im < r.NModified(); ++j) {
+        if (r.Col(j).Modified()) {
+          outs << fCol[j].Name() + "=";
+          outs << r.Col(j);
+          ++im;
+          if (im < r.NModified()) outs << ",";
+        }
+      }
+      outs << " WHERE ";
+      // now print out all pkey values
+      int nkey = fPKeyList.size();
+      for (int j=0; j<nkey; ++j) {
+        int pkeyIdx = fPKeyList[j] - &fCol[0];
+        outs << fPKeyList[j]->Name() << "=" << r.Col(pkeyIdx);
+        if (j < (nkey-1)) outs << " and ";
+      }
 
-      if (fTag == "") return false;
+      return outs.str();
+    }
 
-      std::stringstream myss;
+    //************************************************************
+    // UPDATE a row by primary key with a prepared statement; there is
+    // one statement per set of modified columns.
+    //************************************************************
+    bool Table::UpdateWithPreparedStatement(Row& r)
+    {
+      std::string sig = Schema() + "." + Name() + ":";
+      for (unsigned int j=0; j<fCol.size(); ++j)
+        sig += (r.Col(j).Modified() ? '1' : '0');
+
+      std::vector<int> pcol;
+      for (unsigned int j=0; j<fCol.size(); ++j)
+        if (r.Col(j).Modified()) pcol.push_back(j);
+      for (unsigned int j=0; j<fPKeyList.size(); ++j)
+        pcol.push_back(fPKeyList[j] - &fCol[0]);
+
+      std::string& sql = fUpdateSQL[sig];
+      if (sql.empty()) {
+        std::ostringstream outs;
+        outs << "UPDATE " << Schema() << "." << Name() << " SET ";
+        unsigned int nmod = pcol.size() - fPKeyList.size();
+        for (unsigned int k=0; k<pcol.size(); ++k) {
+          if (k == nmod)
+            outs << " WHERE ";
+          else if (k > nmod)
+            outs << " and ";
+          else if (k > 0)
+            outs << ",";
+          outs << fCol[pcol[k]].Name() << "=$" << k+1;
+        }
+        sql = outs.str();
+      }
 
-      myss << fWSURL << "tag?table=" << Schema() << "." << Name() << "&";
-      myss << "tag=" << fTag;
-      if (override)
-	myss << "&override=yes";
+      std::string name = PrepareStatement(sql,pcol.size());
+      if (name.empty()) return false;
 
-      int status;
-      std::string pwd = GetPassword();
+      std::vector<std::string> value(pcol.size());
+      std::vector<const char*> param(pcol.size());
+      for (unsigned int k=0; k<pcol.size(); ++k) {
+        const Column& c = r.Col(pcol[k]);
+        if (c.IsNull())
+          param[k] = NULL;
+        else {
+          value[k] = c.Value();
+          param[k] = value[k].c_str();
+        }
+      }
 
-      postHTTPsigned(myss.str().c_str(), pwd.c_str(), NULL, 0, NULL, 0, &status);
+      if (fVerbosity > 0)
+        std::cerr << "Table::WriteToDB: Executing prepared statement "
+                  << name << ": \n\t" << MakeUpdateSQL(r) << std::endl;
+
+      PGresult* res = PQexecPrepared(fConnection,name.c_str(),param.size(),
+                                     &param[0],NULL,NULL,0);
+      bool isOk = (PQresultStatus(res) == PGRES_COMMAND_OK);
+      if (!isOk)
+        std::cerr << "UPDATE failed: " << PQerrorMessage(fConnection)
+                  << std::endl;
+      PQclear(res);
 
-      return (status==0);
+      return isOk;
     }
 
     //************************************************************
@@ -2076,6 +4338,8 @@ namespace nutools {
     {
       if (! CheckForNulls()) return false;
 
+      FillRowViews();
+
       bool doWrite = ! fIgnoreDB;
       bool hasConn = fHasConnection;
 
@@ -2123,7 +4387,9 @@ namespace nutools {
 
       PQclear(res);
 
-      std::string cmd = "SET search_path TO " + fSchema;
+      // LOCAL, so that the setting does not outlive this transaction
+      // on a pooled connection
+      std::string cmd = "SET LOCAL search_path TO " + fSchema;
       res = PQexec(fConnection, cmd.c_str());
       if (PQresultStatus(res) != PGRES_COMMAND_OK) {
         std::cerr << "\'" << cmd << "\' command failed" << std::endl;
@@ -2134,6 +4400,13 @@ namespace nutools {
       PQclear(res);
       cmd.clear();
 
+      // send new rows in one go, or in batches, if we can; whatever
+      // fails is inserted one row at a time by the loop below
+      if (fBulkInsert && commit && doWrite)
+        BulkInsertToDB(ts);
+      if (fInsertBatchSize > 1 && commit && doWrite)
+        BatchInsertToDB(ts);
+
       std::map<std::string,int> colMap = GetColNameToIndexMap();
       int insertTimeIdx = colMap["inserttime"];
       int insertUserIdx = colMap["insertuser"];
@@ -2147,44 +4420,8 @@ namespace nutools {
           if (addInsertTime) r.Set(insertTimeIdx,ts);
           if (addInsertUser) r.Set(insertUserIdx,fUser);
 
-          int nrowInsert = fCol.size();
-          for (unsigned int j=0; j<fCol.size(); ++j) {
-            if (fCol[j].Name() == "updatetime")
-              nrowInsert--;
-            else if (fCol[j].Name() == "updateuser")
-              nrowInsert--;
-            else if (fCol[j].Type() == "autoincr")
-              nrowInsert--;
-          }
-
           std::ostringstream outs;
-
-          int ic=0;
-          outs << "INSERT INTO " << Schema() << "." << Name() << " (";
-          for (unsigned int j=0; j<fCol.size(); ++j) {
-            if (fCol[j].Name() == "updatetime") continue;
-            if (fCol[j].Name() == "updateuser") continue;
-            if (fCol[j].Type() == "autoincr") continue;
-
-            outs << fCol[j].Name();
-            if (ic < nrowInsert-1) outs << ",";
-            ++ic;
-          }
-          outs << ") VALUES (";
-
-          ic = 0;
-          for (unsigned int j=0; j<fCol.size(); ++j) {
-            if (fCol[j].Name() == "updatetime") continue;
-            if (fCol[j].Name() == "updateuser") continue;
-            if (fCol[j].Type() == "autoincr") continue;
-
-            outs << r.Col(j);
-
-            if (ic < nrowInsert-1)  outs << ",";
-            ++ic;
-          }
-
-          outs << ")";
+          outs << MakeInsertSQL(r);
 
           if (fVerbosity > 0)
             std::cerr << "Table::WriteToDB: Executing PGSQL command: \n\t"
@@ -2243,38 +4480,34 @@ namespace nutools {
             Row r(fRow[i]);
             if (addUpdateTime) r.Update(updateTimeIdx,ts);
             if (addUpdateUser) r.Update(updateUserIdx,fUser);
-            std::ostringstream outs;
-            outs << "UPDATE " << Schema() << "." << Name() << " SET ";
-            int im = 0;
-            for (unsigned int j=0; j<fCol.size() && im < r.NModified(); ++j) {
-              if (r.Col(j).Modified()) {
-                outs << fCol[j].Name() + "=";
-                outs << r.Col(j);
-                ++im;
-                if (im < r.NModified()) outs << ",";
+
+            if (commit && doWrite && fPrepareStatements &&
+                !fPKeyList.empty()) {
+              if (UpdateWithPreparedStatement(r)) {
+                // set update columns
+                if (addUpdateTime) fRow[i].Col(updateTimeIdx).Set(ts);
+                if (addUpdateUser) fRow[i].Col(updateUserIdx).Set(fUser);
               }
+              else {
+                CacheDBCommand(MakeUpdateSQL(r));
+                retVal = false;
+              }
+              continue;
             }
-            outs << " WHERE ";
-            // now print out all pkey values
-            int nkey = fPKeyList.size();
-            for (int j=0; j<nkey; ++j) {
-              std::string pkey = fPKeyList[j]->Name();
-	      int pkeyIdx = colMap[pkey];
-              outs << pkey << "=" << r.Col(pkeyIdx);
-              if (j < (nkey-1)) outs << " and ";
-            }
+
+            std::string cmd = MakeUpdateSQL(r);
 
             if (fVerbosity > 0)
               std::cerr << "Table::WriteToDB: Executing PGSQL command: \n\t"
-                        << outs.str() << std::endl;
+                        << cmd << std::endl;
 
             if (!commit)
-              std::cout << outs.str() << std::endl;
+              std::cout << cmd << std::endl;
             else {
               if (doWrite) {
-                res = PQexec(fConnection, outs.str().c_str());
+                res = PQexec(fConnection, cmd.c_str());
                 if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-                  CacheDBCommand(outs.str());
+                  CacheDBCommand(cmd);
                   std::cerr << "UPDATE failed: " << PQerrorMessage(fConnection) << std::endl;
                   retVal = false;
                 }
@@ -2286,7 +4519,7 @@ namespace nutools {
                 PQclear(res);
               }
               else
-                CacheDBCommand(outs.str());
+                CacheDBCommand(cmd);
             }
           }
         }
@@ -2307,7 +4540,14 @@ namespace nutools {
       int ncol = this->NCol();
       int nrow = this->NRow();
 
+      // end times get a column of their own, for every row, if any row
+      // has one
+      bool hasEnd = false;
+      for (int i=0; i<nrow && !hasEnd; ++i)
+        hasEnd = (GetRow(i)->VldTimeEnd() > GetRow(i)->VldTime());
+
       ss << "channel,tv,";
+      if (hasEnd) ss << "tvend,";
       bool first = true;
       for (int i=0; i<ncol; ++i) {
         std::string cname = this->GetCol(i)->Name();
@@ -2318,6 +4558,7 @@ namespace nutools {
       ss << std::endl;
       
       ss << "tolerance,,";
+      if (hasEnd) ss << ",";
       first = true;
       for (int j=0; j<ncol; ++j) {
         std::string cname = this->GetCol(j)->Name();
@@ -2338,8 +4579,11 @@ namespace nutools {
       for (int i=0; i<nrow; ++i) {
         ss << GetRow(i)->Channel() << ","
            << GetRow(i)->VldTime() << ",";
-	if (GetRow(i)->VldTimeEnd() > GetRow(i)->VldTime())
-	  ss << GetRow(i)->VldTimeEnd() << ",";
+	if (hasEnd) {
+	  if (GetRow(i)->VldTimeEnd() > GetRow(i)->VldTime())
+	    ss << GetRow(i)->VldTimeEnd();
+	  ss << ",";
+	}
 	first = true;
         for (int j=0; j<ncol; ++j) {
 	  if(!first) ss << ",";
@@ -2413,6 +4657,8 @@ namespace nutools {
                            bool writeColNames)
     {
       if (! CheckForNulls()) return false;
+
+      FillRowViews();
       
       std::ofstream fout;
       if (!appendToFile)
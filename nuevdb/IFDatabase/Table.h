@@ -5,13 +5,21 @@
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <memory>
+#include <future>
+#include <functional>
 #include <cstdlib>
 #include <wda.h>
 
+#include "nuevdb/IFDatabase/Arena.h"
 #include "nuevdb/IFDatabase/DataType.h"
 #include "nuevdb/IFDatabase/Column.h"
 #include "nuevdb/IFDatabase/ColumnDef.h"
+#include "nuevdb/IFDatabase/ColumnStore.h"
+#include "nuevdb/IFDatabase/ConnectionPool.h"
+#include "nuevdb/IFDatabase/ResultStream.h"
 #include "nuevdb/IFDatabase/Row.h"
+#include "nuevdb/IFDatabase/Span.h"
 
 // Forward declarations for postgres types
 struct pg_conn;
@@ -22,6 +30,9 @@ typedef pg_result PGresult;
 namespace nutools {
   namespace dbi {
 
+    class AsyncLoader;
+    class FrozenTable;
+
     enum DBTableType {
       kGenericTable,
       kConditionsTable,
@@ -56,15 +67,20 @@ namespace nutools {
             std::string dbport="", std::string dbuser="");
       ~Table();
 
-      std::string Name() { return fTableName; }
+      /// Rows and the channel index point into the table, and it owns
+      /// a database connection, so it is not copied
+      Table(const Table&) = delete;
+      Table& operator=(const Table&) = delete;
+
+      std::string Name() const { return fTableName; }
       std::string DBName() { return fDBName;}
       std::string DBHost() { return fDBHost;}
       std::string User() { return fUser; }
       std::string Role() { return fRole; }
       std::string DBPort() { return fDBPort; }
-      int  TableType()     { return fTableType; }
-      int  DataSource()    { return fDataSource; }
-      int  DataTypeMask()  { return fDataTypeMask; }
+      int  TableType() const    { return fTableType; }
+      int  DataSource() const   { return fDataSource; }
+      int  DataTypeMask() const { return fDataTypeMask; }
 
       void SetTableName(std::string tname);
       void SetTableName(const char* tname);
@@ -99,19 +115,68 @@ namespace nutools {
 
       void SetVerbosity(int i) { fVerbosity = i;}
 
-      int NCol() {return fCol.size();}
-      int NRow() {return fRow.size();}
+      int NCol() const {return fCol.size();}
+      int NRow() const {return fRow.size() + (fStore.NRow() - fNRowViews);}
 
       void Clear() {
         fRow.clear(); fValidityStart.clear(); fValidityEnd.clear();
         fOrderCol.clear(); fDistinctCol.clear(); fNullList.clear();
+        fStore.Clear(); fNRowViews = 0; fArena.Clear();
+        fSnapIndex.clear(); fSnapMapping.reset();
         fValiditySQL = "";
         fValidityChanged = true;
       }
 
-      void ClearRows() { fRow.clear(); fNullList.clear(); fValidityChanged=true;}
+      void ClearRows() { fRow.clear(); fNullList.clear(); fStore.Clear();
+        fNRowViews = 0; fArena.Clear(); fValidityChanged=true;
+        fSnapIndex.clear(); fSnapMapping.reset(); }
+
+      /// In columnar mode, LoadFromDB(), Load() and LoadFromCSV() parse
+      /// values straight into typed per-column arrays (see ColumnStore).
+      /// Rows are only created, as views onto those arrays, when the
+      /// Row API is first used; GetValue() reads the arrays directly.
+      void SetColumnarStorage(bool f) { fColumnarStorage = f; }
+      bool ColumnarStorage() const { return fColumnarStorage; }
+      const nutools::dbi::ColumnStore& Columns() const { return fStore; }
+
+      /// Write the loaded rows, their validity and the table's columns to
+      /// a binary snapshot file that MapSnapshot() can later stand in for
+      /// a load.  A conditions table also gets its sorted channel index
+      /// (see FillChanRowMap()) written.  The file is replaced atomically.
+      bool SaveSnapshot(const std::string& fname);
+      /// Serve the table from a file written by SaveSnapshot().  The file
+      /// is mapped read-only rather than read, so values are only paged
+      /// in when used, and all the processes on a node that map the same
+      /// file share one copy of it in the page cache.  Columnar storage
+      /// is switched on; a column only gets a private copy if a value in
+      /// it is changed.  Call FillChanRowMap() after this as after Load();
+      /// it checks and takes over the saved channel index in O(n) rather
+      /// than sorting, but still makes a Row, with its Columns, for each
+      /// row (about 100-200 ms and 80 ms of index checks for 2M rows).
+      bool MapSnapshot(const std::string& fname);
+
+      /// Ask the server for results in binary rather than text format in
+      /// LoadFromDB().  Numbers, bools, dates and timestamps are then
+      /// decoded directly instead of going through decimal text.  If the
+      /// query returns a column type that cannot be decoded, the load
+      /// quietly falls back to text format.
+      void SetBinaryTransfer(bool f) { fBinaryTransfer = f; }
+      bool BinaryTransfer() const { return fBinaryTransfer; }
+
+      template <class T>
+        bool GetValue(int irow, int icol, T& val) const
+        {
+          if (irow < 0 || icol < 0 || icol >= (int)fCol.size()) return false;
+          if (irow < (int)fRow.size()) return fRow[irow].Col(icol).Get(val);
+          unsigned int is = fNRowViews + (irow - fRow.size());
+          if (is >= fStore.NRow()) return false;
+          return fStore.Get(is,icol,val);
+        }
 
       nutools::dbi::Row* const GetRow(int i);
+      /// Rows that so far only exist in columnar storage have no Row to
+      /// return here; tables from a TableRegistry always have them all.
+      const nutools::dbi::Row* GetRow(int i) const;
 
       void AddRow(const Row* row);
       void AddRow(const Row& row);
@@ -125,14 +190,14 @@ namespace nutools {
 
       nutools::dbi::Row* const NewRow() { Row* r = new Row(fCol); return r;}
 
-      std::vector<std::string> GetColNames();
-      std::map<std::string,int> GetColNameToIndexMap();
-      std::string GetColName(int i) {return fCol[i].Name(); }
-      int GetColIndex(std::string cname);
+      std::vector<std::string> GetColNames() const;
+      std::map<std::string,int> GetColNameToIndexMap() const;
+      std::string GetColName(int i) const {return fCol[i].Name(); }
+      int GetColIndex(std::string cname) const;
 
-      const nutools::dbi::ColumnDef* GetCol(int i) {return &fCol[i]; }
-      const nutools::dbi::ColumnDef* GetCol(std::string& cname);
-      const nutools::dbi::ColumnDef* GetCol(const char* cname)
+      const nutools::dbi::ColumnDef* GetCol(int i) const {return &fCol[i]; }
+      const nutools::dbi::ColumnDef* GetCol(std::string& cname) const;
+      const nutools::dbi::ColumnDef* GetCol(const char* cname) const
         { std::string cstr(cname); return GetCol(cstr); }
 
       void SetTolerance(std::string& cname, float t);
@@ -140,13 +205,57 @@ namespace nutools {
 
       bool ExistsInDB();
       bool ExecuteSQL(std::string cmd, PGresult*& res);
+      /// As ExecuteSQL(), but the rows are read one at a time as the
+      /// returned stream is iterated; see ResultStream.
+      ResultStream StreamSQL(const std::string& cmd);
 
       bool LoadFromCSV(std::string fname);
       bool LoadFromCSV(const char* fname)
       { return LoadFromCSV(std::string(fname)); }
 
       bool LoadFromDB();
+      /// Make LoadFromDB() read its cursor n rows at a time, so that no
+      /// more than n rows are held by libpq at once; n <= 0 fetches all
+      /// rows in one go.
+      void SetFetchSize(int n) { fFetchSize = n; }
+      int  FetchSize() const { return fFetchSize; }
+      /// Hand each row loaded by LoadFromDB() to sink rather than keeping
+      /// it in the table; the sink returns false to stop the scan.  With
+      /// SetFetchSize() this scans tables of any size in bounded memory.
+      /// Pass an empty function to go back to keeping rows.
+      typedef std::function<bool(const nutools::dbi::Row&)> RowSink;
+      void SetRowSink(RowSink sink) { fRowSink = sink; }
+      /// As LoadFromDB(), but the query runs alongside those of other
+      /// tables on the same AsyncLoader (by default, this thread's).
+      /// The load completes when the loader is driven, by WaitAll() or
+      /// by get() on any of its futures.
+      std::future<bool> LoadAsync(AsyncLoader& loader);
+      std::future<bool> LoadAsync();
+      /// Wait for all LoadAsync() calls made by this thread
+      static bool WaitAll();
       bool WriteToDB(bool commit=true); ///< use commit=false if just testing
+
+      /// In bulk mode WriteToDB() sends all new rows in a single COPY
+      /// rather than one INSERT per row.  If the COPY fails the rows are
+      /// inserted one at a time as usual, so failures still end up in
+      /// the DB command cache.
+      void SetBulkInsert(bool f) { fBulkInsert = f; }
+      bool BulkInsert() const { return fBulkInsert; }
+
+      /// Insert new rows n at a time with multi-row INSERT ... RETURNING
+      /// statements; autoincr values are read back from the RETURNING
+      /// clause.  Unlike bulk mode this fires per-row triggers, and if a
+      /// batch fails its rows are retried one at a time, so errors are
+      /// still reported (and cached) per row.  n <= 1 disables batching.
+      void SetInsertBatchSize(int n) { fInsertBatchSize = n; }
+      int  InsertBatchSize() const { return fInsertBatchSize; }
+
+      /// Use server-side prepared statements for UPDATEs in WriteToDB()
+      /// and for the SELECT in LoadFromDB().  Each distinct statement is
+      /// prepared once per connection, later calls only bind values.
+      /// Do not use this through a transaction-pooling proxy.
+      void SetPrepareStatements(bool f) { fPrepareStatements = f; }
+      bool PrepareStatements() const { return fPrepareStatements; }
       bool WriteToCSV(std::string fname, bool appendToFile=false, bool writeColNames=false);
       bool WriteToCSV(const char* fname, bool appendToFile=false, bool writeColNames=false)
       { return WriteToCSV(std::string(fname),appendToFile,writeColNames); }
@@ -212,7 +321,7 @@ namespace nutools {
       bool GetDetector(std::string& det ) const;
 
       void SetSchema(std::string s) { fSchema = s; }
-      std::string Schema() { return fSchema; }
+      std::string Schema() const { return fSchema; }
 
       template <class T>
         bool SetValidityRange(std::string cname, T start, T end)
@@ -262,6 +371,12 @@ namespace nutools {
       bool CloseConnection();
       void SetConnectionTimeout(int n) { fConnectionTimeout=n;} // units in sec
       int  GetConnectionTimeout() { return fConnectionTimeout; }
+      /// Borrow connections from (and return them to) a shared pool
+      /// instead of opening and closing one each time.
+      void SetConnectionPool(std::shared_ptr<ConnectionPool> p)
+      { fConnectionPool = p; }
+      std::shared_ptr<ConnectionPool> GetConnectionPool() const
+      { return fConnectionPool; }
       bool ResetConnectionInfo();
 
       void CacheDBCommand(std::string cmd);
@@ -275,20 +390,83 @@ namespace nutools {
       double GetMinTSVld() const {return fMinTSVld; }
 
       void SetTag(std::string s) { fTag = s; }
-      std::string GetTag() { return fTag; }
+      std::string GetTag() const { return fTag; }
       bool Tag(std::string tn="", bool override=false);
 
       bool Load();
       bool Write(bool commit=true);
 
-      void ClearChanRowMap() { fChanRowMap.clear(); }
+      /// Turn a loaded table into an immutable one that any number of
+      /// threads may read at once: it is indexed for look-ups, the
+      /// comparison keys of its columns are filled in, and its database
+      /// connection is closed.  The table itself is taken over, not
+      /// copied, since its rows point into it.
+      static std::shared_ptr<const FrozenTable>
+        Freeze(std::unique_ptr<Table> t);
+
+      void ClearChanRowMap() {
+        fChanKey.clear(); fChanOffset.clear(); fChanRow.clear();
+        fChanTime.clear(); fChanMaxEnd.clear();
+        fChanCursor.clear(); fChanDense.clear(); }
       void FillChanRowMap();
-      int  NVldRows(uint64_t channel) { return fChanRowMap[channel].size(); }
-      int  NVldChannels() { return fChanRowMap.size(); }
-      std::vector<uint64_t> VldChannels() { return fChannelVec; }
-
+      int  NVldRows(uint64_t channel) const;
+      int  NVldChannels() const { return fChanKey.size(); }
+      std::vector<uint64_t> VldChannels() const { return fChanKey; }
+
+      /// The row of channel that is valid at time t, ie. the last one
+      /// that starts at or before t and ends after t; null if there is
+      /// none.  A row without a validity end time ends where the next
+      /// row of the channel starts.  This is O(log n) in the rows of
+      /// the channel.  Times are as they were at FillChanRowMap().
       nutools::dbi::Row* GetVldRow(uint64_t channel, double t);
-      std::vector<nutools::dbi::Row*> GetVldRows(uint64_t channel);
+      const nutools::dbi::Row* GetVldRow(uint64_t channel, double t) const;
+      /// Have GetVldRow() remember, per channel, the row it found last,
+      /// and search forwards from there.  This makes look-ups at times
+      /// that mostly go forwards (as in an event loop) O(1) while they
+      /// stay within that row or the next; times that go back (say, with
+      /// kPREV_EVENT) are searched as usual.  It pays off for channels
+      /// with many rows; with only a few, the search is as cheap.  The
+      /// cursors are not thread safe, so a table that uses them must
+      /// not be read by several threads at once.
+      void EnableVldCursor();
+      void DisableVldCursor();
+      bool VldCursor() const { return fVldCursor; }
+      /// The rows of channel that are valid, from their start until
+      /// their end as for GetVldRow(), at some time in [t0,t1], in order
+      /// of validity time
+      void GetVldRows(uint64_t channel, double t0, double t1,
+                      std::vector<const nutools::dbi::Row*>& rows) const;
+      /// The rows of channel that are valid for all of [t0,t1], in order
+      /// of validity time
+      void GetVldRowsCovering(uint64_t channel, double t0, double t1,
+                              std::vector<const nutools::dbi::Row*>& rows) const;
+      /// GetVldRow() for many (channel, time) hits at once: rows[i] is
+      /// the row valid for channel[i] at t[i].  Much cheaper than a call
+      /// per hit for large batches, and cheapest if the hits are already
+      /// in order of channel.  With parallel, TBB spreads the work over
+      /// threads.
+      void GetVldRowBatch(Span<uint64_t> channel, Span<double> t,
+                          std::vector<const nutools::dbi::Row*>& rows,
+                          bool parallel=false) const;
+      /// As GetVldRowBatch(), but the value of column icol in each row;
+      /// missing where there is no row, or its value is NULL or cannot
+      /// be converted
+      template <class T>
+        void GetVldValueBatch(Span<uint64_t> channel, Span<double> t,
+                              int icol, std::vector<T>& val,
+                              const T& missing=T(), bool parallel=false) const
+        {
+          std::vector<const nutools::dbi::Row*> rows;
+          GetVldRowBatch(channel,t,rows,parallel);
+          val.assign(rows.size(),missing);
+          if (icol < 0 || icol >= (int)fCol.size()) return;
+          for (size_t i=0; i<rows.size(); ++i)
+            if (rows[i]) val[i] = rows[i]->Col(icol).GetOr(missing);
+        }
+      /// All rows of channel in order of validity time, without copying;
+      /// valid until the next FillChanRowMap() or ClearChanRowMap()
+      Span<nutools::dbi::Row*> GetVldRows(uint64_t channel);
+      Span<const nutools::dbi::Row*> GetVldRows(uint64_t channel) const;
 
       void SetRecordTime(double t);
       void ClearRecordTime() { fHasRecordTime = false;}
@@ -302,6 +480,16 @@ namespace nutools {
       void SetWSURL(std::string url) { fWSURL = url;}
       void SetQEURL(std::string url) { fQEURL = url;}
 
+      /// Keep web service responses under dir and reuse them instead of
+      /// asking again; "" (the default, unless $DBIWSCACHEDIR is set)
+      /// turns this off.
+      void SetWSCacheDir(std::string dir) { fWSCacheDir = dir; }
+      std::string WSCacheDir() const { return fWSCacheDir; }
+      /// How long, in seconds, a cached response to an untagged query is
+      /// good for; those to tagged queries never change.
+      void SetWSCacheTTL(int ttl) { fWSCacheTTL = ttl; }
+      int  WSCacheTTL() const { return fWSCacheTTL; }
+
       void SetTimeQueries(bool f) {fTimeQueries = f; }
       void SetTimeParsing(bool f) {fTimeParsing = f; }
       bool TimeQueries() {return fTimeQueries; }
@@ -314,6 +502,9 @@ namespace nutools {
 
       void PrintVMUsed();
       void PrintPMUsed();
+      /// Bytes of memory held by this table's rows, values and indices;
+      /// unlike the above it only counts this table.
+      size_t MemoryUsage() const;
 
       bool GetColsFromDB(std::vector<std::string> pkeyList = {});
 
@@ -321,19 +512,75 @@ namespace nutools {
       std::string Folder() { return fFolder; }
       
     private:
+      friend class AsyncLoader;
+      friend class BatchWriter;
+      friend class ResultStream;
+      friend class TableRegistry;
+
 
       bool LoadConditionsTable();
       bool LoadUnstructuredConditionsTable();
       bool LoadNonConditionsTable();
-      bool GetDataFromWebService(Dataset&, std::string);
+      bool GetDataFromWebService(Dataset&, std::string,
+                                 const std::string& cacheKey="");
 
       void Reset();
       bool GetConnectionInfo(int ntry=0);
 
+      /// A column as described by the dB catalog
+      struct CatalogCol {
+        std::string name;
+        std::string type;     ///< information_schema data_type
+        bool        isSerial; ///< integer with a sequence behind it
+      };
+      /// What the dB catalog says about the table
+      struct Catalog {
+        std::vector<CatalogCol>  cols;   ///< of the _update table, for
+                                         ///< conditions tables
+        std::vector<std::string> pkeys;  ///< of the table itself
+        bool                     exists; ///< as ExistsInDB() has it
+      };
+      void GetCatalog(Catalog& cat);
+      std::string CatalogKey();
+      static bool ReadCatalogCache(const std::string& fname,
+                                   const std::string& key, Catalog& cat);
+      static void WriteCatalogCache(const std::string& fname,
+                                    const std::string& key,
+                                    const Catalog& cat);
+      std::vector<std::string> RequiredTables() const;
+      void SetColsFromCatalog(const std::vector<CatalogCol>& cols,
+                              const std::vector<std::string>& pkeyList);
+
       bool CheckForNulls();
 
+      std::string MakeInsertSQL(const nutools::dbi::Row& r);
+      void AddInsertColumns(std::ostream& outs);
+      void AddInsertValues(std::ostream& outs,
+                           const nutools::dbi::Row& r);
+      std::string MakeUpdateSQL(nutools::dbi::Row& r);
+      std::string MakeSelectSQL(std::vector<std::string>* params=0);
+      std::string PrepareStatement(const std::string& sql, int nparam);
+      bool GetConnection(int ntry, bool waitForPool);
+      bool CanLoadBinary(const PGresult* desc);
+      void CacheRows(const PGresult* res, bool isBinary);
+      bool UpdateWithPreparedStatement(nutools::dbi::Row& r);
+      bool BulkInsertToDB(const std::string& ts);
+      bool BatchInsertToDB(const std::string& ts);
+
+      unsigned int AddStoreRows(unsigned int nrow);
+      void FillRowViews() { if (fNRowViews < fStore.NRow()) BuildRowViews(); }
+      void BuildRowViews();
+
       bool MakeConditionsCSVString(std::stringstream& ss);
 
+      void BuildChanRowMap();
+      bool TakeSnapshotIndex();
+      int  ChanIndex(uint64_t channel) const;
+      const nutools::dbi::Row* VldRowAt(int k, unsigned int p,
+                                        double t) const;
+      void FindVldRows(int k, double tv, double tvend,
+                       std::vector<const nutools::dbi::Row*>& rows) const;
+
       std::string GetPassword();
 
       int ParseSelfStatusLine(char* line);
@@ -354,8 +601,15 @@ namespace nutools {
       bool    fDisableCache;
       bool    fTimeQueries;
       bool    fTimeParsing;
+      bool    fColumnarStorage;
+      bool    fBinaryTransfer;
+      bool    fBulkInsert;
+      bool    fPrepareStatements;
       short   fVerbosity;
 
+      int     fInsertBatchSize;
+      int     fWSCacheTTL;
+      int     fFetchSize;
       int     fSelectLimit;
       int     fSelectOffset;
       int     fConnectionTimeout;
@@ -383,22 +637,53 @@ namespace nutools {
       std::string fWSURL;
       std::string fUConDBURL;
       std::string fQEURL;
+      std::string fWSCacheDir;
 
       std::vector<nutools::dbi::ColumnDef> fCol;
       std::vector<nutools::dbi::Row>    fRow;
 
+      nutools::dbi::ColumnStore fStore;
+      unsigned int fNRowViews; ///< number of fStore rows with a view in fRow
+      nutools::dbi::Arena fArena; ///< holds the values of loaded rows
+
       std::vector<nutools::dbi::ColumnDef> fValidityStart;
       std::vector<nutools::dbi::ColumnDef> fValidityEnd;
       std::vector<const nutools::dbi::ColumnDef*> fPKeyList;
+
+      /// parameterised UPDATE statements, by modified-column signature
+      std::unordered_map<std::string,std::string> fUpdateSQL;
       std::vector<const nutools::dbi::ColumnDef*> fDistinctCol;
       std::vector<const nutools::dbi::ColumnDef*> fOrderCol;
       std::vector<std::pair<int,int> > fNullList;
       std::vector<std::string> fExcludeCol;
 
-      std::vector<uint64_t> fChannelVec;
-      std::unordered_map<uint64_t,std::vector<nutools::dbi::Row*> > fChanRowMap;
+      /// The validity rows of channel fChanKey[i] (kept sorted), in order
+      /// of validity time, are fChanRow[fChanOffset[i]] up to, but not
+      /// including, fChanRow[fChanOffset[i+1]]
+      std::vector<uint64_t> fChanKey;
+      std::vector<unsigned int> fChanOffset;
+      std::vector<nutools::dbi::Row*> fChanRow;
+      std::vector<double> fChanTime;  ///< validity time of each fChanRow
+      /// Per channel, a tree of the largest validity end time of its rows
+      /// (see FillChanRowMap()); empty if no row has an end time
+      std::vector<double> fChanMaxEnd;
+      /// fChanKey index of each channel from fChanKey.front() on, or -1;
+      /// only kept if the channel numbers are dense enough
+      std::vector<int> fChanDense;
+      /// The channel index found by MapSnapshot(), for FillChanRowMap()
+      /// to take over: fChanKey, fChanOffset, the row of each fChanRow,
+      /// fChanTime and fChanMaxEnd; empty if there is none
+      std::vector<nutools::dbi::ColumnStore::Section> fSnapIndex;
+      std::shared_ptr<const void> fSnapMapping;  ///< holds fSnapIndex
+      bool fVldCursor;
+      /// Per channel, the index of the row GetVldRow() started from last
+      mutable std::vector<unsigned int> fChanCursor;
 
       PGconn* fConnection;
+      std::shared_ptr<ConnectionPool> fConnectionPool;
+      std::string fPoolKey;  ///< set while fConnection is from the pool
+      bool    fPoolBusy;     ///< last GetConnection() found the pool full
+      RowSink fRowSink;
 
       //      static boost::mutex _xsdLock;
 
@@ -415,6 +700,14 @@ namespace nutools {
       for (unsigned int j=0; j<t.fRow.size(); ++j) {
         stream << t.fRow[j] << std::endl;
       }
+      // rows that so far only exist in columnar storage
+      if (t.fNRowViews < t.fStore.NRow()) {
+        Row r(t.fCol);
+        for (unsigned int j=t.fNRowViews; j<t.fStore.NRow(); ++j) {
+          for (int i=0; i<r.NCol(); ++i) r.Col(i).SetView(&t.fStore,j,i);
+          stream << r << std::endl;
+        }
+      }
       return stream;
     }
 
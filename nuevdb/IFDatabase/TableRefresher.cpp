@@ -0,0 +1,102 @@
+#include <iostream>
+#include <exception>
+
+#include <nuevdb/IFDatabase/TableRefresher.h>
+
+//************************************************************
+namespace nutools {
+  namespace dbi {
+
+    TableRefresher::TableRefresher(Factory factory, double period) :
+      fFactory(factory), fPeriod(period), fTriggered(false), fStop(false),
+      fNRefresh(0), fNFailed(0)
+    {
+      Refresh();
+      fThread = std::thread(&TableRefresher::Run,this);
+    }
+
+    //************************************************************
+    TableRefresher::~TableRefresher()
+    {
+      {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fStop = true;
+      }
+      fWake.notify_all();
+      fThread.join();
+    }
+
+    //************************************************************
+    TableRefresher::Snapshot TableRefresher::Get() const
+    {
+#ifdef __cpp_lib_atomic_shared_ptr
+      return fSnapshot.load();
+#else
+      return std::atomic_load(&fSnapshot);
+#endif
+    }
+
+    //************************************************************
+    void TableRefresher::Trigger()
+    {
+      {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fTriggered = true;
+      }
+      fWake.notify_all();
+    }
+
+    //************************************************************
+    bool TableRefresher::Refresh()
+    {
+      std::lock_guard<std::mutex> lock(fLoadMutex);
+
+      // the new table is loaded and frozen before anyone can see it
+      Snapshot s;
+      try {
+        std::unique_ptr<Table> t = fFactory();
+        if (t && t->Load()) s = Table::Freeze(std::move(t));
+      }
+      catch (std::exception& e) {
+        std::cerr << "TableRefresher::Refresh(): " << e.what() << std::endl;
+      }
+      catch (...) {
+        // nothing may escape the background thread
+      }
+      if (!s) {
+        ++fNFailed;
+        std::cerr << "TableRefresher::Refresh(): load failed, keeping the "
+                  << "previous table" << std::endl;
+        return false;
+      }
+
+#ifdef __cpp_lib_atomic_shared_ptr
+      fSnapshot.store(s);
+#else
+      std::atomic_store(&fSnapshot,s);
+#endif
+      ++fNRefresh;
+      return true;
+    }
+
+    //************************************************************
+    void TableRefresher::Run()
+    {
+      std::unique_lock<std::mutex> lock(fMutex);
+      while (true) {
+        auto wake = [this] { return (fStop || fTriggered); };
+        if (fPeriod.count() > 0)
+          fWake.wait_for(lock,fPeriod,wake);
+        else
+          fWake.wait(lock,wake);
+        if (fStop) break;
+        fTriggered = false;
+
+        lock.unlock();
+        Refresh();
+        lock.lock();
+      }
+    }
+
+  }
+}
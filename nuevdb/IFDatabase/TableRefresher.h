@@ -0,0 +1,88 @@
+#ifndef __DBITABLEREFRESHER_HPP_
+#define __DBITABLEREFRESHER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "nuevdb/IFDatabase/FrozenTable.h"
+
+namespace nutools {
+  namespace dbi {
+
+    /**
+     * Keeps a table up to date for jobs that run for days.
+     *
+     * A background thread loads the table again every so often, or when
+     * asked to with Trigger(), into a new FrozenTable, and then swaps it
+     * in for the old one with a single atomic store (read-copy-update).
+     * Readers take the current snapshot with Get(), which never waits
+     * for a load and never sees one half done; the snapshot they hold
+     * stays valid for as long as they hold it, and an old one is freed
+     * when its last reader lets go.  A load that fails keeps the old
+     * snapshot.
+     *
+     * Each load gets a new Table from the factory, set up (name,
+     * columns, validity window, tag, ...) but not loaded, such as one
+     * from DBIService::CreateTable().
+     */
+    class TableRefresher
+    {
+    public:
+      typedef std::function<std::unique_ptr<Table>()> Factory;
+      typedef std::shared_ptr<const FrozenTable> Snapshot;
+
+      /// Loads the first snapshot before returning, then reloads every
+      /// period seconds; with a period of 0, only when triggered.
+      TableRefresher(Factory factory, double period=0);
+      /// Waits for a load in progress to finish
+      ~TableRefresher();
+
+      TableRefresher(const TableRefresher&) = delete;
+      TableRefresher& operator=(const TableRefresher&) = delete;
+
+      /// The latest snapshot; null if none could be loaded yet
+      Snapshot Get() const;
+
+      /// Have the background thread load the table again now
+      void Trigger();
+      /// Load the table again in this thread; false, keeping the old
+      /// snapshot, if it cannot be loaded
+      bool Refresh();
+
+      long NRefresh() const { return fNRefresh; } ///< snapshots loaded
+      long NFailed() const { return fNFailed; }   ///< loads that failed
+
+    private:
+      void Run();
+
+      Factory fFactory;
+      std::chrono::duration<double> fPeriod;
+
+#ifdef __cpp_lib_atomic_shared_ptr
+      std::atomic<Snapshot> fSnapshot;
+#else
+      Snapshot fSnapshot;  ///< only used through std::atomic_load/store
+#endif
+
+      std::mutex fLoadMutex;  ///< one load at a time
+      std::mutex fMutex;      ///< for the following
+      std::condition_variable fWake;
+      bool fTriggered;
+      bool fStop;
+
+      std::atomic<long> fNRefresh;
+      std::atomic<long> fNFailed;
+
+      std::thread fThread;
+
+    }; // class end
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
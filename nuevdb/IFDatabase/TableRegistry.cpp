@@ -0,0 +1,208 @@
+#include <iomanip>
+#include <sstream>
+
+#include <nuevdb/IFDatabase/TableRegistry.h>
+
+//************************************************************
+namespace nutools {
+  namespace dbi {
+
+    TableRegistry::TableRegistry() :
+      fBudget(0), fUsage(0), fClock(0), fNHit(0), fNMiss(0), fNEvicted(0)
+    {
+    }
+
+    //************************************************************
+    std::string TableRegistry::Key(const Table& t)
+    {
+      std::ostringstream key;
+      key << std::setprecision(17)
+          << t.fDBHost << ":" << t.fDBPort << "/" << t.fDBName << " "
+          << t.fWSURL << " " << t.fQEURL << " " << t.fUConDBURL << "\n"
+          << t.fSchema << "." << t.fTableName
+          << " type=" << t.fTableType
+          << " mask=" << t.fDataTypeMask
+          << " source=" << t.fDataSource
+          << " tag=" << t.fTag
+          << " t=" << t.fMinTSVld << "-" << t.fMaxTSVld
+          << " ch=" << t.fMinChannel << "-" << t.fMaxChannel;
+      if (t.fHasRecordTime) key << " rtime=" << t.fRecordTime;
+      key << " limit=" << t.fSelectLimit << "," << t.fSelectOffset
+          << " desc=" << t.fDescOrder << "\n";
+
+      key << "where " << t.fValiditySQL;
+      for (unsigned int i=0; i<t.fValidityStart.size(); ++i)
+        key << ";" << t.fValidityStart[i].Name() << "="
+            << t.fValidityStart[i].Value() << ".." << t.fValidityEnd[i].Value();
+      key << "\ncolumns";
+      for (unsigned int i=0; i<t.fCol.size(); ++i)
+        key << " " << t.fCol[i].Name() << ":" << t.fCol[i].Type();
+      key << "\nexclude";
+      for (unsigned int i=0; i<t.fExcludeCol.size(); ++i)
+        key << " " << t.fExcludeCol[i];
+      key << "\ndistinct";
+      for (unsigned int i=0; i<t.fDistinctCol.size(); ++i)
+        key << " " << t.fDistinctCol[i]->Name();
+      key << "\norder";
+      for (unsigned int i=0; i<t.fOrderCol.size(); ++i)
+        key << " " << t.fOrderCol[i]->Name();
+
+      return key.str();
+    }
+
+    //************************************************************
+    TableRegistry::Handle TableRegistry::Load(std::unique_ptr<Table> request)
+    {
+      if (!request) return Handle();
+
+      std::string key = Key(*request);
+      std::promise<Handle> loaded;
+      std::shared_future<Handle> f;
+      uint64_t id;
+      {
+        std::lock_guard<std::mutex> lock(fMutex);
+        Evict();
+        id = ++fClock;
+        auto itr = fTable.find(key);
+        if (itr != fTable.end()) {
+          ++fNHit;
+          itr->second.lastUse = id;
+          f = itr->second.table;
+        }
+        else {
+          ++fNMiss;
+          Entry& e = fTable[key];
+          e.table = loaded.get_future().share();
+          e.size = 0;
+          e.id = id;
+          e.lastUse = id;
+        }
+      }
+      if (f.valid()) return f.get();
+
+      // load outside the lock, so that other tables can load meanwhile
+      Handle h;
+      try {
+        if (request->Load())
+          h = Table::Freeze(std::move(request));
+      }
+      catch (...) {
+        {
+          std::lock_guard<std::mutex> lock(fMutex);
+          auto itr = fTable.find(key);
+          if (itr != fTable.end() && itr->second.id == id) fTable.erase(itr);
+        }
+        loaded.set_exception(std::current_exception());
+        throw;
+      }
+
+      size_t size = (h ? h->MemoryUsage() : 0);
+      loaded.set_value(h);
+
+      // a failed load is not kept, so that the next request tries again.
+      // The entry may also have gone already, with a Release().
+      std::lock_guard<std::mutex> lock(fMutex);
+      auto itr = fTable.find(key);
+      if (itr != fTable.end() && itr->second.id == id) {
+        if (!h)
+          fTable.erase(itr);
+        else {
+          itr->second.size = size;
+          fUsage += size;
+          Evict();
+        }
+      }
+
+      return h;
+    }
+
+    //************************************************************
+    void TableRegistry::Release()
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fTable.clear();
+      fUsage = 0;
+    }
+
+    //************************************************************
+    void TableRegistry::Trim()
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      Evict();
+    }
+
+    //************************************************************
+    void TableRegistry::Evict()
+    {
+      if (fBudget == 0) return;
+
+      while (fUsage > fBudget) {
+        // the least recently requested table that only we hold
+        auto lru = fTable.end();
+        for (auto itr = fTable.begin(); itr != fTable.end(); ++itr) {
+          const Entry& e = itr->second;
+          if (e.size == 0) continue;  // still loading
+          if (e.table.get().use_count() > 1) continue;
+          if (lru == fTable.end() || e.lastUse < lru->second.lastUse)
+            lru = itr;
+        }
+        if (lru == fTable.end()) break;
+
+        fUsage -= lru->second.size;
+        fTable.erase(lru);
+        ++fNEvicted;
+      }
+    }
+
+    //************************************************************
+    void TableRegistry::SetMemoryBudget(size_t n)
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fBudget = n;
+      Evict();
+    }
+
+    //************************************************************
+    size_t TableRegistry::MemoryBudget() const
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fBudget;
+    }
+
+    //************************************************************
+    size_t TableRegistry::MemoryUsage() const
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fUsage;
+    }
+
+    //************************************************************
+    unsigned int TableRegistry::NTable() const
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fTable.size();
+    }
+
+    //************************************************************
+    long TableRegistry::NHit() const
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fNHit;
+    }
+
+    //************************************************************
+    long TableRegistry::NMiss() const
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fNMiss;
+    }
+
+    //************************************************************
+    long TableRegistry::NEvicted() const
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fNEvicted;
+    }
+
+  }
+}
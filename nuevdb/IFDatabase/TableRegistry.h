@@ -0,0 +1,94 @@
+#ifndef __DBITABLEREGISTRY_HPP_
+#define __DBITABLEREGISTRY_HPP_
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+
+#include "nuevdb/IFDatabase/FrozenTable.h"
+
+namespace nutools {
+  namespace dbi {
+
+    /**
+     * Loaded tables shared by everyone in a process who asks for the
+     * same contents.
+     *
+     * A request is a Table that is set up (name, schema, columns,
+     * validity window, tag, ...) but not yet loaded.  The first request
+     * for some contents is loaded and kept; later requests that would
+     * load exactly the same thing are thrown away and get a handle to
+     * the kept table instead, so the query, the parsing and the memory
+     * are paid for once.  Kept tables are frozen (Table::Freeze()), so
+     * that any number of threads can read them at once.
+     *
+     * Tables are reference counted.  Release() (at a run boundary, say)
+     * makes the registry let go of them, and each one is freed when its
+     * last handle goes.
+     *
+     * With a memory budget, the registry instead lets go of the least
+     * recently requested tables that nobody else holds whenever the
+     * tables it keeps (by Table::MemoryUsage()) use more than that.  A
+     * request for an evicted table simply loads it again.
+     */
+    class TableRegistry
+    {
+    public:
+      typedef std::shared_ptr<const FrozenTable> Handle;
+
+      TableRegistry();
+
+      TableRegistry(const TableRegistry&) = delete;
+      TableRegistry& operator=(const TableRegistry&) = delete;
+
+      /// The loaded table that request describes; null if it cannot be
+      /// loaded.  Requests for tables being loaded by another thread
+      /// wait for that load.
+      Handle Load(std::unique_ptr<Table> request);
+
+      /// Forget all tables; handles already given out stay valid
+      void Release();
+      /// Evict tables until the kept ones fit the memory budget.  This
+      /// also happens on every Load().
+      void Trim();
+
+      /// Bytes that the kept tables may use; 0 means no limit
+      void   SetMemoryBudget(size_t n);
+      size_t MemoryBudget() const;
+      size_t MemoryUsage() const;  ///< of all kept tables
+
+      unsigned int NTable() const;
+      long NHit() const;   ///< requests served from a kept table
+      long NMiss() const;  ///< requests that had to be loaded
+      long NEvicted() const;
+
+      /// Everything that decides what Load() reads for t
+      static std::string Key(const Table& t);
+
+    private:
+      struct Entry {
+        std::shared_future<Handle> table; ///< ready once loaded
+        size_t   size;     ///< 0 until loaded
+        uint64_t id;       ///< fClock when the load began
+        uint64_t lastUse;  ///< fClock at the last request
+      };
+
+      void Evict();  ///< Trim() with fMutex held
+
+      mutable std::mutex fMutex;
+      std::map<std::string,Entry> fTable;
+      size_t   fBudget;
+      size_t   fUsage;
+      uint64_t fClock;
+      long fNHit;
+      long fNMiss;
+      long fNEvicted;
+
+    }; // class end
+
+  } // namespace dbi close
+} // namespace nutools close
+
+#endif
@@ -0,0 +1,93 @@
+//
+// Micro-benchmark of Column::Get() and Column::GetOr() against the
+// lexical_cast of the value string that Get() used to do, for each
+// column type.  Not built by default; "make benchColumnGet" to build.
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include "nuevdb/IFDatabase/Column.h"
+#include "nuevdb/IFDatabase/ColumnDef.h"
+
+using namespace nutools::dbi;
+
+namespace {
+
+  typedef std::chrono::steady_clock Clock;
+
+  template <class T>
+    double Sum(const T& v) { return v; }
+  double Sum(const std::string& v) { return v.size(); }
+
+  //************************************************************
+  // ns per call of each path over ncol columns of the given type,
+  // filled round-robin from vals, read nrep times
+  //************************************************************
+  template <class T>
+    void Run(const char* type, const std::vector<std::string>& vals,
+             int ncol, int nrep)
+  {
+    ColumnDef cd("x",type);
+    std::vector<Column> cols(ncol,Column(cd));
+    for (unsigned int i=0; i<cols.size(); ++i)
+      cols[i].FastSet(vals[i%vals.size()]);
+
+    double s[3] = {0,0,0};
+    Clock::time_point t[4];
+
+    t[0] = Clock::now();
+    for (int r=0; r<nrep; ++r)
+      for (unsigned int i=0; i<cols.size(); ++i)
+        s[0] += Sum(T(boost::lexical_cast<T>(cols[i].Value())));
+    t[1] = Clock::now();
+    for (int r=0; r<nrep; ++r)
+      for (unsigned int i=0; i<cols.size(); ++i) {
+        T v = T();
+        cols[i].Get(v);
+        s[1] += Sum(v);
+      }
+    t[2] = Clock::now();
+    for (int r=0; r<nrep; ++r)
+      for (unsigned int i=0; i<cols.size(); ++i)
+        s[2] += Sum(cols[i].GetOr(T()));
+    t[3] = Clock::now();
+
+    double n = double(ncol)*nrep;
+    double ns[3];
+    for (int k=0; k<3; ++k)
+      ns[k] = std::chrono::duration<double,std::nano>(t[k+1]-t[k]).count()/n;
+
+    printf("%-10s %12.1f %8.1f %8.1f%s\n",type,ns[0],ns[1],ns[2],
+           (s[0] == s[1] && s[1] == s[2] ? "" : "  (values differ!)"));
+  }
+
+}
+
+int main(int argc, char *argv[])
+{
+  int ncol = (argc > 1 ? atoi(argv[1]) : 200000);
+  int nrep = (argc > 2 ? atoi(argv[2]) : 5);
+  if (ncol <= 0 || nrep <= 0) {
+    fprintf(stderr,"Usage: benchColumnGet [number of columns] [repeats]\n");
+    exit(1);
+  }
+
+  printf("ns per call, %d columns read %d times\n",ncol,nrep);
+  printf("%-10s %12s %8s %8s\n","type","lexical_cast","Get","GetOr");
+  Run<short>("smallint",{"12","-471","+7","0"},ncol,nrep);
+  Run<int>("int",{"12","-4711","100000","+7","0"},ncol,nrep);
+  Run<long>("bigint",{"1234567890123","-9","42"},ncol,nrep);
+  Run<long>("autoincr",{"1","2","1234567"},ncol,nrep);
+  Run<double>("double",{"3.14159","-1e-7","42","6.02214076e23"},ncol,nrep);
+  Run<float>("float",{"1.5","-0.25","1e3"},ncol,nrep);
+  Run<bool>("bool",{"1","0","1","0"},ncol,nrep);
+  Run<std::string>("text",{"hello","a longer string value here"},ncol,nrep);
+  Run<std::string>("timestamp",{"2015-03-16 12:48:28"},ncol,nrep);
+  Run<std::string>("date",{"2015-03-16"},ncol,nrep);
+
+  return 0;
+}